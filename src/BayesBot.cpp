@@ -6,6 +6,9 @@
  * Created 2018-12 by Julia Ebert
  */
 
+#ifndef BAYESBOT_CPP
+#define BAYESBOT_CPP
+
 #include <kilosim/Kilobot.h>
 extern "C" {
 #include "incbeta.h"
@@ -15,95 +18,512 @@ extern "C" {
 #define FALSE 0
 #define TRUE 1
 
+// Maximum number of neighbors remembered at once
+#define NEIGHBOR_INFO_ARRAY_SIZE 100
+// Maximum number of messages held between controller ticks
+#define RX_MESSAGE_QUEUE_SIZE 8
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
 namespace Kilosim
 {
 
+// Helpers for (de)serializing controller state as raw bytes
+template <typename T>
+void put_state(std::vector<char> &buf, const T &val)
+{
+    const char *bytes = (const char *)&val;
+    buf.insert(buf.end(), bytes, bytes + sizeof(T));
+}
+
+template <typename T>
+T get_state(const char *&pos)
+{
+    T val;
+    memcpy(&val, pos, sizeof(T));
+    pos += sizeof(T);
+    return val;
+}
+
+template <typename T>
+T get_state(const char *&pos, const char *end, bool &ok)
+{
+    // Bounds-checked version: if fewer than sizeof(T) bytes are left, clears
+    // ok and returns zero without moving pos
+    T val;
+    if (end - pos < (long)sizeof(T))
+    {
+        ok = false;
+        memset(&val, 0, sizeof(T));
+        return val;
+    }
+    return get_state<T>(pos);
+}
+
 typedef struct neighbor_info_array_t
 {
     // One entry (row) in a table of observations from neighbors
-    float measured_distance;
     uint16_t id;
     uint16_t obs_ind;
     uint32_t time_first_heard_from;
 } neighbor_info_array_t;
 
-class BayesBot : public Kilobot
+// When robots broadcast their message (see BayesBot::is_tx_tick)
+enum TxPolicy
 {
-public:
-    // Variables for aggregators
-    uint32_t dark_count = 0;      // beta in Beta distribution
-    uint32_t light_count = 0;     // alpha in Beta distribution
-    int8_t decision = -1;         // 0 or 1 value of decision, once made
-    uint16_t observation_ind = 0; // Index observations so receivers know if it's new
+    TX_ALWAYS,     // Every kilotick
+    TX_PERIODIC,   // Once every tx_period kiloticks (staggered by ID)
+    TX_ON_CHANGE,  // When the message changes, and every tx_keepalive kiloticks
+    TX_DUTY_CYCLE, // At random, on a tx_duty_cycle fraction of kiloticks
+};
 
-    // Public allows prior to be set from main function in initialization
-    // Setting these different from 1,1 changes from uniform prior
+typedef struct BayesBotParams
+{
+    // Configuration shared by every robot in a condition
+    // Setting the priors different from 1,1 changes from uniform prior
     uint32_t light_prior = 1; // alpha prior
     uint32_t dark_prior = 1;  // beta prior
     uint8_t use_positive_feedback = TRUE;
     double credible_thresh = 0.95; // % of prob. that must be above/below 0.5
     uint8_t allow_simultaneity = TRUE;
-    uint32_t observe_step_time; // Time between observations (seconds)
-    uint32_t disseminate_dur;   // in kiloticks (only relevant if !allow_simultaneity)
+    uint32_t observe_step_time = 45; // Time between observations (seconds)
+    uint32_t disseminate_dur = 0;    // in kiloticks (only relevant if !allow_simultaneity)
+    uint16_t controller_period = 1;  // Run loop() every this many kiloticks
+    uint8_t tx_policy = TX_ALWAYS;
+    uint32_t tx_period = 1;         // in kiloticks (TX_PERIODIC)
+    uint32_t tx_keepalive = SECOND; // in kiloticks (TX_ON_CHANGE; at least 1)
+    float tx_duty_cycle = 1;        // fraction of kiloticks (TX_DUTY_CYCLE)
+} BayesBotParams;
+
+inline void save_params(std::vector<char> &buf, const BayesBotParams &params)
+{
+    // Append the parameters field by field (as save_state does), so no
+    // struct padding is written
+    put_state(buf, params.light_prior);
+    put_state(buf, params.dark_prior);
+    put_state(buf, params.use_positive_feedback);
+    put_state(buf, params.credible_thresh);
+    put_state(buf, params.allow_simultaneity);
+    put_state(buf, params.observe_step_time);
+    put_state(buf, params.disseminate_dur);
+    put_state(buf, params.controller_period);
+    put_state(buf, params.tx_policy);
+    put_state(buf, params.tx_period);
+    put_state(buf, params.tx_keepalive);
+    put_state(buf, params.tx_duty_cycle);
+}
+
+inline bool load_params(const char *&pos, const char *end, BayesBotParams &params)
+{
+    // Inverse of save_params. Returns false if the buffer is cut short.
+    bool ok = true;
+    params.light_prior = get_state<uint32_t>(pos, end, ok);
+    params.dark_prior = get_state<uint32_t>(pos, end, ok);
+    params.use_positive_feedback = get_state<uint8_t>(pos, end, ok);
+    params.credible_thresh = get_state<double>(pos, end, ok);
+    params.allow_simultaneity = get_state<uint8_t>(pos, end, ok);
+    params.observe_step_time = get_state<uint32_t>(pos, end, ok);
+    params.disseminate_dur = get_state<uint32_t>(pos, end, ok);
+    params.controller_period = get_state<uint16_t>(pos, end, ok);
+    params.tx_policy = get_state<uint8_t>(pos, end, ok);
+    params.tx_period = get_state<uint32_t>(pos, end, ok);
+    params.tx_keepalive = get_state<uint32_t>(pos, end, ok);
+    params.tx_duty_cycle = get_state<float>(pos, end, ok);
+    return ok;
+}
+
+class NeighborTablePool
+{
+    // One contiguous block holding every robot's neighbor table, so table
+    // size can match the swarm instead of a fixed per-robot array
+private:
+    std::vector<neighbor_info_array_t> m_entries;
+    uint16_t m_table_size;
+
+public:
+    NeighborTablePool(uint32_t num_tables, uint16_t table_size)
+        : m_entries((size_t)num_tables * table_size), m_table_size(table_size) {}
+
+    neighbor_info_array_t *table(uint32_t ind)
+    {
+        return &m_entries[(size_t)ind * m_table_size];
+    }
+
+    uint16_t table_size() const
+    {
+        return m_table_size;
+    }
+
+    size_t bytes_per_table() const
+    {
+        return m_table_size * sizeof(neighbor_info_array_t);
+    }
+
+    static uint16_t size_for_swarm(uint32_t num_robots)
+    {
+        // A robot can't hear from more than every other robot
+        uint32_t max_neighbors = num_robots > 1 ? num_robots - 1 : 1;
+        return max_neighbors < NEIGHBOR_INFO_ARRAY_SIZE ? max_neighbors : NEIGHBOR_INFO_ARRAY_SIZE;
+    }
+};
+
+class BayesBot;
+class BayesBotTap;
+
+typedef struct GenericPolicy
+{
+    // Policy flags read from the condition's parameters at every use, and
+    // the robot's tap (if any) checked at every use
+    const BayesBotParams *params;
+    BayesBotTap *tap;
+    bool positive_feedback() const { return params->use_positive_feedback; }
+    bool simultaneity() const { return params->allow_simultaneity; }
+    uint32_t light_prior() const { return params->light_prior; }
+    uint32_t dark_prior() const { return params->dark_prior; }
+    bool multirate() const { return params->controller_period > 1; }
+    uint8_t tx_policy() const { return params->tx_policy; }
+    bool tapped() const { return tap != nullptr; }
+} GenericPolicy;
+
+template <bool PositiveFeedback, bool Simultaneity, bool UniformPrior,
+          uint8_t Tx, bool Multirate, bool Tapped>
+struct FixedPolicy
+{
+    // Policy flags fixed at compile time (a uniform prior is 1,1; Multirate
+    // is controller_period > 1). Only Tapped variants check for a tap.
+    const BayesBotParams *params;
+    BayesBotTap *tap;
+    bool positive_feedback() const { return PositiveFeedback; }
+    bool simultaneity() const { return Simultaneity; }
+    uint32_t light_prior() const { return UniformPrior ? 1 : params->light_prior; }
+    uint32_t dark_prior() const { return UniformPrior ? 1 : params->dark_prior; }
+    bool multirate() const { return Multirate; }
+    uint8_t tx_policy() const { return Tx; }
+    bool tapped() const { return Tapped && tap != nullptr; }
+};
+
+class BayesBotTap
+{
+    // Sees every input to a BayesBot controller, to record or replay them
+    // (see ControllerTrace.hpp). Also supplies its ambient light readings.
+public:
+    virtual ~BayesBotTap() {}
+    virtual void on_loop(const BayesBot &bot) = 0;
+    virtual int16_t ambientlight(BayesBot &bot) = 0;
+    virtual void on_message_rx(const BayesBot &bot, const message_t &msg,
+                               const distance_measurement_t &dist) = 0;
+    virtual void on_message_tx(const BayesBot &bot) = 0;
+    virtual void on_message_tx_success(const BayesBot &bot) = 0;
+};
+
+class BayesBot : public Kilobot
+{
+public:
+    // Variables for aggregators
+    uint32_t dark_count;      // beta in Beta distribution
+    uint32_t light_count;     // alpha in Beta distribution
+    uint16_t observation_ind; // Index observations so receivers know if it's new
+    int8_t decision;          // 0 or 1 value of decision, once made
+    uint32_t messages_sent;      // Broadcasts (non-NULL message_tx)
+    uint32_t messages_delivered; // Broadcasts heard by at least one robot
+    uint32_t messages_ignored;   // Received but not used (old news or dropped)
+
+    // Shared configuration, set from main function in initialization
+    const BayesBotParams *params = &default_params();
+    // Optional hook on the controller's inputs (NULL = normal operation)
+    BayesBotTap *tap = nullptr;
+
+    BayesBot()
+    {
+        reset();
+    }
+
+    void attach_neighbor_table(neighbor_info_array_t *table, uint16_t table_size)
+    {
+        // Use externally-owned storage (see NeighborTablePool) for neighbors
+        neighbor_info_array = table;
+        neighbor_table_size = table_size;
+        initialize_neighbor_info_array();
+    }
+
+    void reset()
+    {
+        // Return the controller to its freshly-constructed state so the same
+        // robot can be reused for another trial (call before robot_init)
+        dark_count = 0;
+        light_count = 0;
+        decision = -1;
+        observation_ind = 0;
+        messages_sent = 0;
+        messages_delivered = 0;
+        messages_ignored = 0;
+        kilo_ticks = 0;
+        curr_light_level = DARK;
+        state = OBSERVE;
+        rw_state = RW_INIT;
+        bounce_turn_state = TURN_LEFT;
+        is_feature_detect_safe = FALSE;
+        observation = 0;
+        new_observation = FALSE;
+        num_rx_messages = 0;
+        neighbor_info_array_locked = FALSE;
+        state_change_timer = 0;
+        rw_last_changed = 0;
+        rw_state_dur = 0;
+        last_observation_tick = 0;
+        beta_thresh_val = 0.5;
+        rw_turn_left = FALSE;
+        color_stale = TRUE;
+        tx_stale = TRUE;
+        last_tx_tick = 0;
+        initialize_neighbor_info_array();
+        set_motors(0, 0);
+    }
+
+    void seed_controller(uint32_t seed)
+    {
+        // Each robot draws from its own generator so its random state can be
+        // saved and restored along with the rest of the controller
+        rng_state = seed != 0 ? seed : 1;
+    }
+
+    void save_state(std::vector<char> &buf) const
+    {
+        // Append everything needed to resume this robot exactly (pose,
+        // controller state, random generator, and neighbor table)
+        put_state(buf, x);
+        put_state(buf, y);
+        put_state(buf, theta);
+        put_state(buf, kilo_ticks);
+        put_state(buf, dark_count);
+        put_state(buf, light_count);
+        put_state(buf, observation_ind);
+        put_state(buf, decision);
+        put_state(buf, messages_sent);
+        put_state(buf, messages_delivered);
+        put_state(buf, messages_ignored);
+        put_state(buf, rw_last_changed);
+        put_state(buf, rw_state_dur);
+        put_state(buf, last_observation_tick);
+        put_state(buf, state_change_timer);
+        put_state(buf, rng_state);
+        put_state(buf, (uint8_t)curr_light_level);
+        put_state(buf, (uint8_t)state);
+        put_state(buf, (uint8_t)rw_state);
+        put_state(buf, (uint8_t)bounce_turn_state);
+        put_state(buf, (uint8_t)is_feature_detect_safe);
+        put_state(buf, (uint8_t)observation);
+        put_state(buf, (uint8_t)new_observation);
+        put_state(buf, (uint8_t)rw_turn_left);
+        put_state(buf, (uint8_t)tx_stale);
+        put_state(buf, last_tx_tick);
+        put_state(buf, tx_message_data);
+        put_state(buf, beta_thresh_val);
+        put_state(buf, num_rx_messages);
+        for (uint8_t m = 0; m < num_rx_messages; ++m)
+        {
+            put_state(buf, rx_message_buffer[m]);
+        }
+        put_state(buf, neighbor_table_size);
+        for (uint16_t i = 0; i < neighbor_table_size; ++i)
+        {
+            put_state(buf, neighbor_info_array[i]);
+        }
+    }
+
+    bool load_state(const char *&pos, const char *end)
+    {
+        // Inverse of save_state (after the robot has been reset and attached
+        // to a neighbor table). Returns false if the neighbor tables differ
+        // or the state is cut short.
+        bool ok = true;
+        x = get_state<double>(pos, end, ok);
+        y = get_state<double>(pos, end, ok);
+        theta = get_state<double>(pos, end, ok);
+        kilo_ticks = get_state<uint32_t>(pos, end, ok);
+        dark_count = get_state<uint32_t>(pos, end, ok);
+        light_count = get_state<uint32_t>(pos, end, ok);
+        observation_ind = get_state<uint16_t>(pos, end, ok);
+        decision = get_state<int8_t>(pos, end, ok);
+        messages_sent = get_state<uint32_t>(pos, end, ok);
+        messages_delivered = get_state<uint32_t>(pos, end, ok);
+        messages_ignored = get_state<uint32_t>(pos, end, ok);
+        rw_last_changed = get_state<uint32_t>(pos, end, ok);
+        rw_state_dur = get_state<uint32_t>(pos, end, ok);
+        last_observation_tick = get_state<uint32_t>(pos, end, ok);
+        state_change_timer = get_state<uint32_t>(pos, end, ok);
+        rng_state = get_state<uint32_t>(pos, end, ok);
+        curr_light_level = get_state<uint8_t>(pos, end, ok);
+        state = get_state<uint8_t>(pos, end, ok);
+        rw_state = get_state<uint8_t>(pos, end, ok);
+        bounce_turn_state = get_state<uint8_t>(pos, end, ok);
+        is_feature_detect_safe = get_state<uint8_t>(pos, end, ok);
+        observation = get_state<uint8_t>(pos, end, ok);
+        new_observation = get_state<uint8_t>(pos, end, ok);
+        rw_turn_left = get_state<uint8_t>(pos, end, ok);
+        tx_stale = get_state<uint8_t>(pos, end, ok);
+        last_tx_tick = get_state<uint32_t>(pos, end, ok);
+        tx_message_data = get_state<message_t>(pos, end, ok);
+        beta_thresh_val = get_state<double>(pos, end, ok);
+        num_rx_messages = get_state<uint8_t>(pos, end, ok);
+        if (!ok || num_rx_messages > RX_MESSAGE_QUEUE_SIZE)
+            return false;
+        for (uint8_t m = 0; m < num_rx_messages; ++m)
+        {
+            rx_message_buffer[m] = get_state<message_t>(pos, end, ok);
+        }
+        if (get_state<uint16_t>(pos, end, ok) != neighbor_table_size || !ok)
+            return false;
+        for (uint16_t i = 0; i < neighbor_table_size; ++i)
+        {
+            neighbor_info_array[i] = get_state<neighbor_info_array_t>(pos, end, ok);
+        }
+        if (!ok)
+            return false;
+        neighbor_info_array_locked = FALSE;
+        color_stale = TRUE;
+        update_next_prune_tick();
+        resume_motors();
+        return true;
+    }
+
+    uint32_t get_kilo_ticks() const
+    {
+        return kilo_ticks;
+    }
+
+    int16_t sensed_ambientlight()
+    {
+        // Reading from the World's light pattern (bypassing any tap)
+        return get_ambientlight();
+    }
+
+    // Call the controller directly at the given kilotick, without a World
+    // (for replaying traces)
+    void replay_loop(uint32_t tick)
+    {
+        kilo_ticks = tick;
+        loop();
+    }
+
+    void replay_message_rx(uint32_t tick, message_t msg, distance_measurement_t dist)
+    {
+        kilo_ticks = tick;
+        message_rx(&msg, &dist);
+    }
+
+    message_t *replay_message_tx(uint32_t tick)
+    {
+        kilo_ticks = tick;
+        return message_tx();
+    }
+
+    void replay_message_tx_success(uint32_t tick)
+    {
+        kilo_ticks = tick;
+        message_tx_success();
+    }
 
 private:
+    static const BayesBotParams &default_params()
+    {
+        static const BayesBotParams defaults;
+        return defaults;
+    }
+
     // Easier-to-read color values
-    const uint8_t DARK = 0;
-    const uint8_t GRAY = 1;
-    const uint8_t LIGHT = 2;
-    uint8_t curr_light_level; // DARK, GRAY, or LIGHT, initialized in setup()
+    enum : uint8_t
+    {
+        DARK = 0,
+        GRAY = 1,
+        LIGHT = 2
+    };
 
     // Task states
-    const uint8_t OBSERVE = 0;
-    const uint8_t DISSEMINATE = 1;
-    const uint8_t OBSERVE_DISSEMINATE = 2; // Both at once
-    uint8_t state;
-    uint32_t state_change_timer;
+    enum : uint8_t
+    {
+        OBSERVE = 0,
+        DISSEMINATE = 1,
+        OBSERVE_DISSEMINATE = 2 // Both at once
+    };
 
     // Random walk patterns
-    const uint8_t RW_INIT = 0;
-    const uint8_t RW_STRAIGHT = 1;
-    const uint8_t RW_TURN = 2;
-    uint8_t rw_state = RW_INIT;
-    const uint8_t TURN_LEFT = 0;
-    const uint8_t TURN_RIGHT = 1;
-    uint32_t rw_last_changed = 0;                 // kilotick when rw_state last changed
-    uint32_t rw_mean_straight_dur = 240 * SECOND; // kiloticks
-    uint32_t rw_max_turn_dur = 12 * SECOND;       // kiloticks
+    // Bounce out of gray area when it gets there (like a screensaver)
+    enum : uint8_t
+    {
+        RW_INIT = 0,
+        RW_STRAIGHT = 1,
+        RW_TURN = 2,
+        BOUNCE = 3
+    };
+    enum : uint8_t
+    {
+        TURN_LEFT = 0,
+        TURN_RIGHT = 1
+    };
+
+    static const uint32_t rw_mean_straight_dur = 240 * SECOND;        // kiloticks
+    static const uint32_t rw_max_turn_dur = 12 * SECOND;              // kiloticks
+    static const uint32_t neighbor_info_array_timeout = 900 * SECOND; // kiloticks
+
+    // HOT: touched on every loop()
+
+    uint32_t rw_last_changed; // kilotick when rw_state last changed
     // Actual turn/straight durations are set at beginning of transition to that state
     uint32_t rw_state_dur;
-    uint8_t is_feature_detect_safe = FALSE; // Feature detection needs to be enabled in loop
+    uint32_t last_observation_tick;
+    uint32_t state_change_timer;
 
-    // Bounce out of gray area when it gets there (like a screensaver)
-    const uint8_t BOUNCE = 100;
-    uint8_t bounce_turn_state;
+    // Packed states and flags (two bytes in total)
+    uint8_t curr_light_level : 2; // DARK, GRAY, or LIGHT, updated every loop
+    uint8_t state : 2;            // OBSERVE, DISSEMINATE, or OBSERVE_DISSEMINATE
+    uint8_t rw_state : 2;         // RW_* or BOUNCE
+    uint8_t bounce_turn_state : 1;
+    uint8_t is_feature_detect_safe : 1; // Feature detection needs to be enabled in loop
+    uint8_t observation : 1;            // 0 or 1
+    uint8_t new_observation : 1;
+    uint8_t neighbor_info_array_locked : 1;
+    uint8_t rw_turn_left : 1; // Direction of the current RW_TURN
+    uint8_t color_stale : 1;  // Decision or belief changed since set_color
+    uint8_t tx_stale : 1;     // Message content changed since it was sent
 
-    // Observation variables/parameters
-    uint32_t last_observation_tick;
-    uint8_t observation; // 0 or 1
-    uint8_t new_observation = FALSE;
+    // Earliest kilotick at which a neighbor entry can time out, so the table
+    // is only scanned when something is actually due to expire
+    uint32_t next_prune_tick;
 
-    // Messages/communication
-#define NEIGHBOR_INFO_ARRAY_SIZE 100
-    neighbor_info_array_t neighbor_info_array[NEIGHBOR_INFO_ARRAY_SIZE];
-    message_t rx_message_buffer;
-    distance_measurement_t rx_distance_buffer;
-    uint8_t new_message = 0;
-    uint8_t neighbor_info_array_locked = FALSE;
-    uint32_t neighbor_info_array_timeout = 900 * SECOND; // kiloticks
-    message_t tx_message_data;
+    uint16_t neighbor_table_size = 0;
+    neighbor_info_array_t *neighbor_info_array = nullptr;
+
+    // COLD: only touched when messages arrive or are sent
 
     // DEBUG values
-    double beta_thresh_val = 0.5;
+    double beta_thresh_val;
+    uint32_t rng_state = 1; // xorshift32 state (see seed_controller)
+    // Messages received since the last controller tick
+    uint8_t num_rx_messages;
+    message_t rx_message_buffer[RX_MESSAGE_QUEUE_SIZE];
+    message_t tx_message_data; // Last message built (rebuilt when tx_stale)
+    uint32_t last_tx_tick;
 
     //--------------------------------------------------------------------------
     // GENERALLY USEFUL FUNCTIONS
     //--------------------------------------------------------------------------
 
+    uint8_t rand_byte()
+    {
+        // Random value from 0 to 255 (stands in for the kilobot's rand_hard)
+        rng_state ^= rng_state << 13;
+        rng_state ^= rng_state >> 17;
+        rng_state ^= rng_state << 5;
+        return rng_state >> 24;
+    }
+
     uint32_t uniform_rand(uint32_t max_val)
     {
         // Generate a random int from 0 to max_val
-        uint32_t rand_val = (uint32_t)rand_hard() / 255.0 * max_val;
+        uint32_t rand_val = (uint32_t)rand_byte() / 255.0 * max_val;
         return rand_val;
     }
 
@@ -112,7 +532,7 @@ private:
         // Generate random value from exponential distribution with mean mean_val
         // According to: http://stackoverflow.com/a/11491526/2552873
         // Generate random float (0,1)
-        double unif_val = (double)rand_hard() / 255.0;
+        double unif_val = (double)rand_byte() / 255.0;
         uint32_t exp_val = uint32_t(-log(unif_val) * mean_val);
         return exp_val;
     }
@@ -121,7 +541,7 @@ private:
     {
         // Count how many neighbors in neighbor info array (how many with non-zero ID)
         uint16_t num_neighbors = 0;
-        for (uint8_t i = 0; i < NEIGHBOR_INFO_ARRAY_SIZE; i++)
+        for (uint16_t i = 0; i < neighbor_table_size; i++)
         {
             if (neighbor_info_array[i].id != 0)
                 num_neighbors++;
@@ -129,10 +549,11 @@ private:
         return num_neighbors;
     }
 
-    uint8_t find_wall_collision()
+    template <typename Policy>
+    uint8_t find_wall_collision(const Policy &policy)
     {
         // Use light sensor to detect if outside the black/white area (into gray)
-        uint8_t light_level = detect_light_level();
+        uint8_t light_level = detect_light_level(policy);
         if (light_level == GRAY)
             return 1;
         else
@@ -146,8 +567,8 @@ private:
                light_count, dark_count,
                decision);
 
-        printf("Index\tID\tFeature\tBelief\tD_meas.\tN_Heard\tTime\n\r");
-        for (uint8_t i = 0; i < NEIGHBOR_INFO_ARRAY_SIZE; ++i)
+        printf("Index\tID\tObs_ind\tTime\n\r");
+        for (uint16_t i = 0; i < neighbor_table_size; ++i)
         {
             if (neighbor_info_array[i].id != 0)
             {
@@ -155,7 +576,7 @@ private:
                        //  1   2   3   4   5   6   7
                        i,
                        neighbor_info_array[i].id,
-                       ((uint8_t)neighbor_info_array[i].measured_distance),
+                       neighbor_info_array[i].obs_ind,
                        (uint16_t)(kilo_ticks - neighbor_info_array[i].time_first_heard_from));
             }
         }
@@ -163,35 +584,56 @@ private:
 
     void initialize_neighbor_info_array()
     {
-        for (uint8_t i = 0; i < NEIGHBOR_INFO_ARRAY_SIZE; ++i)
+        for (uint16_t i = 0; i < neighbor_table_size; ++i)
         {
-            neighbor_info_array[i].id = 0;
+            neighbor_info_array[i] = neighbor_info_array_t();
+        }
+        next_prune_tick = UINT32_MAX;
+    }
+
+    void update_next_prune_tick()
+    {
+        // Find when the oldest remaining neighbor times out
+        next_prune_tick = UINT32_MAX;
+        for (uint16_t i = 0; i < neighbor_table_size; ++i)
+        {
+            uint32_t expiry = neighbor_info_array[i].time_first_heard_from + neighbor_info_array_timeout;
+            if (neighbor_info_array[i].id != 0 && expiry < next_prune_tick)
+                next_prune_tick = expiry;
         }
     }
 
     void prune_neighbor_info_array()
     {
         // Get rid of neighbors from timeout table after a fixed length of time
-        for (uint8_t i = 0; i < NEIGHBOR_INFO_ARRAY_SIZE; ++i)
+        // (Nothing can have timed out before next_prune_tick)
+        if (kilo_ticks <= next_prune_tick)
+            return;
+        for (uint16_t i = 0; i < neighbor_table_size; ++i)
         {
             if (kilo_ticks > (neighbor_info_array[i].time_first_heard_from + neighbor_info_array_timeout))
             {
                 neighbor_info_array[i].id = 0;
             }
         }
+        update_next_prune_tick();
     }
 
-    void update_neighbor_info_array(message_t *m, distance_measurement_t *d)
+    bool update_neighbor_info_array(message_t *m, distance_measurement_t *d)
     {
         /*
          * Add an incoming message to the array of received messages info.
          * If a neighbor is not in the table, add it. Old data will be removed
          * after a fixed-length time out. New data from the robot will be used
          * only if it is after the timeout (aka not in the table)
+         * Returns whether the message's observation was used.
          */
+        if (neighbor_table_size == 0)
+            return false;
+
         bool can_insert = false;
         bool new_entry;
-        uint8_t index_to_insert;
+        uint16_t index_to_insert;
 
         uint16_t rx_id = (((uint16_t)m->data[0]) << 8) | ((uint16_t)(m->data[1]));
         uint8_t obs_val = m->data[2]; // observation value. (0=dark, 1=light)
@@ -199,7 +641,7 @@ private:
 
         // printf("%u:\t%u\t%u\t%u\n", id, rx_id, obs_val, rx_obs_ind);
 
-        for (uint8_t i = 0; i < NEIGHBOR_INFO_ARRAY_SIZE; ++i)
+        for (uint16_t i = 0; i < neighbor_table_size; ++i)
         {
             if (neighbor_info_array[i].id == rx_id)
             {
@@ -211,7 +653,7 @@ private:
         }
         if (!can_insert)
         {
-            for (uint8_t i = 0; i < NEIGHBOR_INFO_ARRAY_SIZE; ++i)
+            for (uint16_t i = 0; i < neighbor_table_size; ++i)
             {
                 if (neighbor_info_array[i].id == 0)
                 {
@@ -227,11 +669,16 @@ private:
         {
             // This robot isn't in the array, and there isn't an empty space
             // So kick out the oldest message/robot
-            uint8_t earliest_heard_time = 0;
-            uint8_t earliest_heard_time_index;
-            for (uint8_t i = 0; i < NEIGHBOR_INFO_ARRAY_SIZE; ++i)
+            // (Before the neighbor tables were pooled this compared against a
+            // truncated uint8_t, so it evicted an arbitrary entry or read an
+            // uninitialized index. Fixing it changes results whenever a robot
+            // hears from more distinct neighbors than its table holds within
+            // neighbor_info_array_timeout.)
+            uint32_t earliest_heard_time = neighbor_info_array[0].time_first_heard_from;
+            uint16_t earliest_heard_time_index = 0;
+            for (uint16_t i = 1; i < neighbor_table_size; ++i)
             {
-                if (neighbor_info_array[i].time_first_heard_from > earliest_heard_time)
+                if (neighbor_info_array[i].time_first_heard_from < earliest_heard_time)
                 {
                     earliest_heard_time = neighbor_info_array[i].time_first_heard_from;
                     earliest_heard_time_index = i;
@@ -246,24 +693,30 @@ private:
         if (can_insert && new_entry)
         {
             neighbor_info_array[index_to_insert].time_first_heard_from = kilo_ticks;
+            if (kilo_ticks + neighbor_info_array_timeout < next_prune_tick)
+                next_prune_tick = kilo_ticks + neighbor_info_array_timeout;
             neighbor_info_array[index_to_insert].id = rx_id;
             // Update Beta model with incoming observations ONLY if observation index changed
-            if (neighbor_info_array[index_to_insert].obs_ind != rx_obs_ind)
+            bool is_new_obs = neighbor_info_array[index_to_insert].obs_ind != rx_obs_ind;
+            if (is_new_obs)
                 update_beta(obs_val);
             neighbor_info_array[index_to_insert].obs_ind = rx_obs_ind;
+            return is_new_obs;
         }
+        return false;
     }
 
     //--------------------------------------------------------------------------
     // AUXILIARY FUNCTIONS
     //--------------------------------------------------------------------------
 
-    void random_walk(uint32_t mean_straight_dur, uint32_t max_turn_dur)
+    template <typename Policy>
+    void random_walk(const Policy &policy, uint32_t mean_straight_dur, uint32_t max_turn_dur)
     {
         // Non-blocking random walk, iterating between turning and walking states
         // Durations are in kiloticks
 
-        uint8_t wall_hit = find_wall_collision();
+        uint8_t wall_hit = find_wall_collision(policy);
         if (wall_hit != 0 && rw_state != BOUNCE)
         {
             // Check for wall collision before anything else
@@ -296,8 +749,8 @@ private:
             rw_state_dur = uniform_rand(max_turn_dur);
             // Set turning direction
             spinup_motors();
-            bool is_turn_left = rand_hard() & 1;
-            if (is_turn_left)
+            rw_turn_left = rand_byte() & 1;
+            if (rw_turn_left)
             {
                 set_motors(kilo_turn_left, 0);
             }
@@ -327,7 +780,7 @@ private:
         // Don't forget to end the bounce phase in the calling function as well...
 
         // Now it doesn't know what wall it hit. Randomly pick a direction to turn?
-        if (rand() % 2 == 0)
+        if (rand_byte() % 2 == 0)
             bounce_turn_state = TURN_LEFT;
         else
             bounce_turn_state = TURN_RIGHT;
@@ -339,12 +792,30 @@ private:
             set_motors(0, kilo_turn_right);
     }
 
-    uint8_t detect_light_level()
+    void resume_motors()
+    {
+        // Re-issue the motor command for the current movement state
+        if (rw_state == RW_STRAIGHT)
+            set_motors(kilo_straight_left, kilo_straight_right);
+        else if (rw_state == RW_TURN && rw_turn_left)
+            set_motors(kilo_turn_left, 0);
+        else if (rw_state == RW_TURN)
+            set_motors(0, kilo_turn_left);
+        else if (rw_state == BOUNCE && bounce_turn_state == TURN_LEFT)
+            set_motors(kilo_turn_left, 0);
+        else if (rw_state == BOUNCE)
+            set_motors(0, kilo_turn_right);
+        else
+            set_motors(0, 0);
+    }
+
+    template <typename Policy>
+    uint8_t detect_light_level(const Policy &policy)
     {
         // Detect/return light level (DARK = [0,250), GRAY = [250-750), LIGHT = [750-1024])
         // This version is for MONOCHROME FEATURES, where all light is assumed to be in channel 0 (red)
         // Get current light level
-        uint16_t light = get_ambientlight();
+        uint16_t light = policy.tapped() ? policy.tap->ambientlight(*this) : get_ambientlight();
         if (light < 250)
             return DARK;
 
@@ -354,26 +825,6 @@ private:
             return LIGHT;
     }
 
-    double update_decision()
-    {
-        /* Check whether a decision can be made.
-         * Uses the credible interval for the Beta distribution
-         * 0 = decide low/dark
-         * 1 = decide high/light
-         * -1 = undecided
-         */
-        // % of probability mass below 0.5
-        double beta_thresh = incbeta(light_count + light_prior, dark_count + dark_prior, 0.5);
-        // std::cout << "[" << id << "]\t" << light_count + light_prior << ", " << dark_count + dark_prior << "\t" << beta_thresh << std::endl;
-        if (beta_thresh > credible_thresh)
-            decision = 0;
-        else if (beta_thresh < (1 - credible_thresh))
-            decision = 1;
-        else
-            decision = -1;
-        return beta_thresh;
-    }
-
     void update_beta(uint8_t obs)
     {
         // Add a 0/1 to the Beta distribution counts
@@ -387,7 +838,7 @@ private:
          * Make an observation of the color after every fixed-length step
          * This sets the `observation` value and `new_observation` flag
          */
-        if (last_observation_tick + observe_step_time * SECOND <= kilo_ticks)
+        if (last_observation_tick + params->observe_step_time * SECOND <= kilo_ticks)
         {
             if (curr_light_level != GRAY)
             {
@@ -403,35 +854,54 @@ private:
     }
 
     //--------------------------------------------------------------------------
-    // REQUIRED KILOBOT FUNCTIONS
+    // POLICY-DEPENDENT FUNCTIONS
+    // (Policy is GenericPolicy for this class, or a FixedPolicy for the
+    // specialized BayesBotVariant)
     //--------------------------------------------------------------------------
 
-    void setup()
+protected:
+    template <typename Policy>
+    double update_decision(const Policy &policy)
     {
-        // Deal with feature/bug of limited battery life
-        // battery = 60 * 60 * SECOND * 20; // 20 hours (in kiloticks)
-        battery = 100000 * SECOND;
-
-        curr_light_level = detect_light_level();
-        rw_last_changed = kilo_ticks;
-        set_color(RGB(0.5, 0.5, 0.5));
-        initialize_neighbor_info_array();
-        if (allow_simultaneity)
-            state = OBSERVE_DISSEMINATE;
+        /* Check whether a decision can be made.
+         * Uses the credible interval for the Beta distribution
+         * 0 = decide low/dark
+         * 1 = decide high/light
+         * -1 = undecided
+         */
+        // % of probability mass below 0.5
+        double beta_thresh = incbeta(light_count + policy.light_prior(), dark_count + policy.dark_prior(), 0.5);
+        // std::cout << "[" << id << "]\t" << light_count + light_prior << ", " << dark_count + dark_prior << "\t" << beta_thresh << std::endl;
+        if (beta_thresh > params->credible_thresh)
+            decision = 0;
+        else if (beta_thresh < (1 - params->credible_thresh))
+            decision = 1;
         else
-            state = OBSERVE;
+            decision = -1;
+        return beta_thresh;
     }
 
-    void loop()
+    template <typename Policy>
+    void loop_with(const Policy &policy)
     {
         // DEBUG
         //std::cout << id << ":  " << x << ", " << y << std::endl;
+        if (policy.tapped())
+            policy.tap->on_loop(*this);
+
+        // Only run on this robot's controller ticks (phases are staggered by
+        // ID so the work is spread evenly). Timers compare elapsed kiloticks,
+        // so they still fire on the first controller tick after they're due.
+        if (policy.multirate() &&
+            kilo_ticks % params->controller_period != id % params->controller_period)
+            return;
 
-        curr_light_level = detect_light_level();
+        curr_light_level = detect_light_level(policy);
         // Movement depending on state/feature
-        random_walk(rw_mean_straight_dur, rw_max_turn_dur);
+        random_walk(policy, rw_mean_straight_dur, rw_max_turn_dur);
 
-        if (state == OBSERVE || state == OBSERVE_DISSEMINATE)
+        // (With simultaneity, the state is always OBSERVE_DISSEMINATE)
+        if (policy.simultaneity() || state == OBSERVE || state == OBSERVE_DISSEMINATE)
         {
             // Observe
             observe_color();
@@ -439,10 +909,14 @@ private:
             {
                 update_beta(observation);
                 if (decision == -1)
-                    beta_thresh_val = update_decision();
+                {
+                    beta_thresh_val = update_decision(policy);
+                    color_stale = TRUE;
+                }
                 new_observation = FALSE;
                 observation_ind++;
-                if (!allow_simultaneity)
+                tx_stale = TRUE;
+                if (!policy.simultaneity())
                 {
                     // Change to disseminating new observation
                     state = DISSEMINATE;
@@ -451,49 +925,66 @@ private:
             }
         }
 
-        // Process new received message
+        // Process messages received since the last controller tick
         // Update beta distribution if it's a new observation (by index)
         neighbor_info_array_locked = TRUE;
-        if (new_message)
+        for (uint8_t m = 0; m < num_rx_messages; ++m)
         {
-            // (This also runs update_beta)
-            update_neighbor_info_array(&rx_message_buffer, &rx_distance_buffer);
-            new_message = FALSE;
+            // (This also runs update_beta). The belief only changes if the
+            // message was used.
+            if (!update_neighbor_info_array(&rx_message_buffer[m], NULL))
+            {
+                messages_ignored++;
+                continue;
+            }
             if (decision == -1)
-                beta_thresh_val = update_decision();
+            {
+                beta_thresh_val = update_decision(policy);
+                color_stale = TRUE;
+                // The message only carries the decision with positive feedback
+                if (policy.positive_feedback() && decision != -1)
+                    tx_stale = TRUE;
+            }
         }
+        num_rx_messages = 0;
         prune_neighbor_info_array();
         neighbor_info_array_locked = FALSE;
 
         // Check for and update decisions (only if undecided)
-        if (decision == 0)
-            set_color(RGB(1, 0, 0));
-        else if (decision == 1)
-            set_color(RGB(0, 1, 0));
-        else
+        // The color only changes when the decision or belief does
+        if (color_stale)
         {
-            set_color(RGB(beta_thresh_val * .8, (1 - beta_thresh_val) * .8, 0.5 * .8));
-            // set_color(RGB(0, 0, 1));
-            // printf("%u:\t%u\t%u\n", id, light_count, dark_count);
+            if (decision == 0)
+                set_color(RGB(1, 0, 0));
+            else if (decision == 1)
+                set_color(RGB(0, 1, 0));
+            else
+            {
+                set_color(RGB(beta_thresh_val * .8, (1 - beta_thresh_val) * .8, 0.5 * .8));
+                // set_color(RGB(0, 0, 1));
+                // printf("%u:\t%u\t%u\n", id, light_count, dark_count);
+            }
+            color_stale = FALSE;
         }
 
         // Switch back to observation (if can't do everything simultaneously)
         // and past disseminate_dur
-        if (!allow_simultaneity && state == DISSEMINATE &&
-            state_change_timer + disseminate_dur <= kilo_ticks)
+        if (!policy.simultaneity() && state == DISSEMINATE &&
+            state_change_timer + params->disseminate_dur <= kilo_ticks)
         {
             state == OBSERVE;
         }
     }
 
-    void update_tx_message_data()
+    template <typename Policy>
+    void update_tx_message_data(const Policy &policy)
     {
         tx_message_data.type = NORMAL;
         // ID
         tx_message_data.data[0] = ((uint8_t)((id & 0xff00) >> 8));
         tx_message_data.data[1] = ((uint8_t)(id & 0x00ff));
         // Observation value (0=dark, 1=light) OR decision
-        if (decision != -1 && use_positive_feedback)
+        if (policy.positive_feedback() && decision != -1)
             tx_message_data.data[2] = decision;
         else
             tx_message_data.data[2] = observation;
@@ -503,30 +994,225 @@ private:
         tx_message_data.crc = message_crc(&tx_message_data);
     }
 
-    void message_rx(message_t *msg, distance_measurement_t *dist)
+    template <typename Policy>
+    bool is_tx_tick(const Policy &policy) const
     {
-        if (!neighbor_info_array_locked)
+        // Whether the transmit policy sends on this kilotick
+        switch (policy.tx_policy())
         {
-            rx_message_buffer = (*msg);
-            rx_distance_buffer = (*dist);
-            new_message = TRUE;
-            // TODO: Needs to be moved out of here (to loop function) for actual kilobots
+        case TX_PERIODIC:
+            return kilo_ticks % params->tx_period == id % params->tx_period;
+        case TX_ON_CHANGE:
+            // (Receivers only use a neighbor's first message until it times
+            // out, so repeats of an unchanged message only matter to robots
+            // that come into range later)
+            return tx_stale || kilo_ticks - last_tx_tick >= params->tx_keepalive;
+        case TX_DUTY_CYCLE:
+        {
+            // Hash of ID and tick, so the random stream isn't disturbed
+            uint32_t h = (id * 2654435761u) ^ (kilo_ticks * 2246822519u);
+            h ^= h >> 15;
+            h *= 2654435761u;
+            h ^= h >> 13;
+            return (h & 0xffff) < params->tx_duty_cycle * 0x10000;
+        }
+        default:
+            return true;
         }
     }
 
+    template <typename Policy>
+    message_t *message_tx_with(const Policy &policy)
+    {
+        if (policy.tapped())
+            policy.tap->on_message_tx(*this);
+        if (!(policy.simultaneity() || state == DISSEMINATE || state == OBSERVE_DISSEMINATE) ||
+            !is_tx_tick(policy))
+            return NULL;
+        // The message only changes with the observation or decision
+        if (tx_stale)
+        {
+            update_tx_message_data(policy);
+            tx_stale = FALSE;
+        }
+        last_tx_tick = kilo_ticks;
+        messages_sent++;
+        return &tx_message_data;
+    }
+
+    //--------------------------------------------------------------------------
+    // REQUIRED KILOBOT FUNCTIONS
+    //--------------------------------------------------------------------------
+
+private:
+    void setup()
+    {
+        // Deal with feature/bug of limited battery life
+        // battery = 60 * 60 * SECOND * 20; // 20 hours (in kiloticks)
+        battery = 100000 * SECOND;
+
+        curr_light_level = detect_light_level(GenericPolicy{params, tap});
+        rw_last_changed = kilo_ticks;
+        set_color(RGB(0.5, 0.5, 0.5));
+        color_stale = TRUE;
+        initialize_neighbor_info_array();
+        if (params->allow_simultaneity)
+            state = OBSERVE_DISSEMINATE;
+        else
+            state = OBSERVE;
+    }
+
+    void loop()
+    {
+        loop_with(GenericPolicy{params, tap});
+    }
+
+    void message_rx(message_t *msg, distance_measurement_t *dist)
+    {
+        message_rx_with(GenericPolicy{params, tap}, msg, dist);
+    }
+
     message_t *message_tx()
     {
-        if (state == DISSEMINATE || state == OBSERVE_DISSEMINATE)
+        return message_tx_with(GenericPolicy{params, tap});
+    }
+
+    void message_tx_success()
+    {
+        message_tx_success_with(GenericPolicy{params, tap});
+    }
+
+protected:
+    template <typename Policy>
+    void message_rx_with(const Policy &policy, message_t *msg, distance_measurement_t *dist)
+    {
+        if (policy.tapped())
+            policy.tap->on_message_rx(*this, *msg, *dist);
+        if (!neighbor_info_array_locked)
         {
-            update_tx_message_data();
-            return &tx_message_data;
+            // Hold up to one message per kilotick until the next controller
+            // tick. When full, the newest message replaces the last one (so
+            // at full rate this is a single buffer, as on a real kilobot).
+            uint8_t capacity = params->controller_period < RX_MESSAGE_QUEUE_SIZE
+                                   ? params->controller_period
+                                   : RX_MESSAGE_QUEUE_SIZE;
+            if (num_rx_messages < capacity)
+                num_rx_messages++;
+            else
+                messages_ignored++;
+            rx_message_buffer[num_rx_messages - 1] = (*msg);
+            // TODO: Needs to be moved out of here (to loop function) for actual kilobots
         }
         else
         {
-            return NULL;
+            messages_ignored++;
         }
     }
 
-    void message_tx_success() {}
+    template <typename Policy>
+    void message_tx_success_with(const Policy &policy)
+    {
+        if (policy.tapped())
+            policy.tap->on_message_tx_success(*this);
+        messages_delivered++;
+    }
+};
+
+template <bool PositiveFeedback, bool Simultaneity, bool UniformPrior,
+          uint8_t Tx, bool Multirate, bool Tapped>
+class BayesBotVariant : public BayesBot
+{
+    // BayesBot with its policy flags fixed at compile time, so the controller
+    // callbacks carry no branches on them (and untapped variants none on the
+    // tap). Create with new_bayes_bot().
+private:
+    typedef FixedPolicy<PositiveFeedback, Simultaneity, UniformPrior, Tx, Multirate, Tapped> Policy;
+
+    void loop()
+    {
+        loop_with(Policy{params, tap});
+    }
+
+    void message_rx(message_t *msg, distance_measurement_t *dist)
+    {
+        message_rx_with(Policy{params, tap}, msg, dist);
+    }
+
+    message_t *message_tx()
+    {
+        return message_tx_with(Policy{params, tap});
+    }
+
+    void message_tx_success()
+    {
+        message_tx_success_with(Policy{params, tap});
+    }
 };
+
+template <bool PositiveFeedback, bool Simultaneity, bool UniformPrior, bool Tapped>
+inline BayesBot *new_bayes_bot_variant(const BayesBotParams &params)
+{
+    // Second half of new_bayes_bot: fix the transmit policy and rate
+    bool multirate = params.controller_period > 1;
+    switch (params.tx_policy)
+    {
+    case TX_PERIODIC:
+        if (multirate)
+            return new BayesBotVariant<PositiveFeedback, Simultaneity, UniformPrior, TX_PERIODIC, true, Tapped>();
+        return new BayesBotVariant<PositiveFeedback, Simultaneity, UniformPrior, TX_PERIODIC, false, Tapped>();
+    case TX_ON_CHANGE:
+        if (multirate)
+            return new BayesBotVariant<PositiveFeedback, Simultaneity, UniformPrior, TX_ON_CHANGE, true, Tapped>();
+        return new BayesBotVariant<PositiveFeedback, Simultaneity, UniformPrior, TX_ON_CHANGE, false, Tapped>();
+    case TX_DUTY_CYCLE:
+        if (multirate)
+            return new BayesBotVariant<PositiveFeedback, Simultaneity, UniformPrior, TX_DUTY_CYCLE, true, Tapped>();
+        return new BayesBotVariant<PositiveFeedback, Simultaneity, UniformPrior, TX_DUTY_CYCLE, false, Tapped>();
+    default:
+        if (multirate)
+            return new BayesBotVariant<PositiveFeedback, Simultaneity, UniformPrior, TX_ALWAYS, true, Tapped>();
+        return new BayesBotVariant<PositiveFeedback, Simultaneity, UniformPrior, TX_ALWAYS, false, Tapped>();
+    }
+}
+
+template <bool Tapped>
+inline BayesBot *new_bayes_bot_flags(const BayesBotParams &params)
+{
+    // First half of new_bayes_bot: fix the policy flags
+    bool feedback = params.use_positive_feedback;
+    bool simultaneity = params.allow_simultaneity;
+    bool uniform_prior = params.light_prior == 1 && params.dark_prior == 1;
+    if (feedback && simultaneity && uniform_prior)
+        return new_bayes_bot_variant<true, true, true, Tapped>(params);
+    else if (feedback && simultaneity)
+        return new_bayes_bot_variant<true, true, false, Tapped>(params);
+    else if (feedback && uniform_prior)
+        return new_bayes_bot_variant<true, false, true, Tapped>(params);
+    else if (feedback)
+        return new_bayes_bot_variant<true, false, false, Tapped>(params);
+    else if (simultaneity && uniform_prior)
+        return new_bayes_bot_variant<false, true, true, Tapped>(params);
+    else if (simultaneity)
+        return new_bayes_bot_variant<false, true, false, Tapped>(params);
+    else if (uniform_prior)
+        return new_bayes_bot_variant<false, false, true, Tapped>(params);
+    else
+        return new_bayes_bot_variant<false, false, false, Tapped>(params);
+}
+
+inline BayesBot *new_bayes_bot(const BayesBotParams &params, bool specialize = true,
+                               bool tapped = false)
+{
+    // Create the controller specialized for this condition's policy flags,
+    // transmit policy and rate (or the generic one, which checks them every
+    // tick). Only a tapped controller can have a BayesBotTap attached.
+    if (!specialize)
+        return new BayesBot();
+    if (tapped)
+        return new_bayes_bot_flags<true>(params);
+    return new_bayes_bot_flags<false>(params);
+}
+
 } // namespace Kilosim
+
+#endif // BAYESBOT_CPP
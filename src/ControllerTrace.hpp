@@ -0,0 +1,381 @@
+/*
+ * Record and replay the inputs to BayesBot controllers
+ *
+ * A TraceRecorder taps every robot in a TrialContext and records each call
+ * into its controller (loop, message_rx, message_tx, message_tx_success),
+ * along with the ambient light readings and received messages. A TracePlayer
+ * rebuilds the controllers from the trace's starting state and makes the same
+ * calls again without a World. This lets controller code be profiled apart
+ * from physics, and checked against the recorded final state.
+ */
+
+#ifndef CONTROLLER_TRACE_HPP
+#define CONTROLLER_TRACE_HPP
+
+#include "Snapshot.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace Kilosim
+{
+
+// File identifier and format version ("KTR" + 3)
+const uint32_t trace_magic = 0x0352544b;
+
+// Events in a robot's trace
+enum : uint8_t
+{
+    TRACE_LOOP,
+    TRACE_LIGHT, // (Only inside a loop)
+    TRACE_RX,
+    TRACE_TX,
+    TRACE_TX_SUCCESS,
+};
+
+// save_state starts with the pose and kilo_ticks, which only a World advances
+const size_t trace_unchecked_state_bytes = 3 * sizeof(double) + sizeof(uint32_t);
+
+class RobotTraceTap : public BayesBotTap
+{
+    // Records one robot's events. Each is its type followed by the kiloticks
+    // since the previous event (or 255 and then the full tick)
+private:
+    uint32_t m_last_tick = 0;
+
+    void put_event(uint8_t type, const BayesBot &bot)
+    {
+        uint32_t tick = bot.get_kilo_ticks();
+        put_state(events, type);
+        if (tick >= m_last_tick && tick - m_last_tick < 255)
+        {
+            put_state(events, (uint8_t)(tick - m_last_tick));
+        }
+        else
+        {
+            put_state(events, (uint8_t)255);
+            put_state(events, tick);
+        }
+        m_last_tick = tick;
+    }
+
+public:
+    std::vector<char> events;
+
+    void start(const BayesBot &bot)
+    {
+        events.clear();
+        m_last_tick = bot.get_kilo_ticks();
+    }
+
+    void on_loop(const BayesBot &bot)
+    {
+        put_event(TRACE_LOOP, bot);
+    }
+
+    int16_t ambientlight(BayesBot &bot)
+    {
+        int16_t light = bot.sensed_ambientlight();
+        put_event(TRACE_LIGHT, bot);
+        put_state(events, light);
+        return light;
+    }
+
+    void on_message_rx(const BayesBot &bot, const message_t &msg,
+                       const distance_measurement_t &dist)
+    {
+        put_event(TRACE_RX, bot);
+        put_state(events, msg);
+        put_state(events, dist);
+    }
+
+    void on_message_tx(const BayesBot &bot)
+    {
+        put_event(TRACE_TX, bot);
+    }
+
+    void on_message_tx_success(const BayesBot &bot)
+    {
+        put_event(TRACE_TX_SUCCESS, bot);
+    }
+};
+
+class ReplayTap : public BayesBotTap
+{
+    // Reads one robot's events back, and supplies the recorded light readings
+    // to its controller
+private:
+    const char *m_end = nullptr;
+
+public:
+    const char *pos = nullptr;
+    uint32_t tick = 0;
+    // Set if the controller asked for light when the trace didn't have it
+    bool diverged = false;
+
+    void start(const std::vector<char> &events, uint32_t start_tick)
+    {
+        pos = events.data();
+        m_end = events.data() + events.size();
+        tick = start_tick;
+        diverged = false;
+    }
+
+    bool done() const
+    {
+        return pos >= m_end;
+    }
+
+    uint8_t next_event()
+    {
+        uint8_t type = get_state<uint8_t>(pos);
+        uint8_t delta = get_state<uint8_t>(pos);
+        tick = delta < 255 ? tick + delta : get_state<uint32_t>(pos);
+        return type;
+    }
+
+    void on_loop(const BayesBot &bot) {}
+
+    int16_t ambientlight(BayesBot &bot)
+    {
+        if (done() || next_event() != TRACE_LIGHT)
+        {
+            diverged = true;
+            pos = m_end;
+            return 0;
+        }
+        return get_state<int16_t>(pos);
+    }
+
+    void on_message_rx(const BayesBot &bot, const message_t &msg,
+                       const distance_measurement_t &dist) {}
+    void on_message_tx(const BayesBot &bot) {}
+    void on_message_tx_success(const BayesBot &bot) {}
+};
+
+inline void put_trace_block(std::vector<char> &buf, const std::vector<char> &block)
+{
+    put_state(buf, (uint32_t)block.size());
+    buf.insert(buf.end(), block.begin(), block.end());
+}
+
+inline bool get_trace_block(const char *&pos, const char *end, std::vector<char> &block)
+{
+    if (end - pos < (long)sizeof(uint32_t))
+        return false;
+    uint32_t size = get_state<uint32_t>(pos);
+    if (end - pos < (long)size)
+        return false;
+    block.assign(pos, pos + size);
+    pos += size;
+    return true;
+}
+
+class TraceRecorder
+{
+    // Records a context's trial from the current tick until write() is called
+private:
+    TrialContext &m_context;
+    std::vector<char> m_start_state;
+    std::vector<RobotTraceTap> m_taps;
+
+public:
+    TraceRecorder(TrialContext &context)
+        : m_context(context),
+          m_start_state(capture_snapshot(context)),
+          m_taps(context.robots.size())
+    {
+        if (!context.is_tapped())
+        {
+            std::cout << "ERROR: Can't record a trace of untapped controllers" << std::endl;
+            exit(1);
+        }
+        for (uint n = 0; n < m_taps.size(); n++)
+        {
+            m_taps[n].start(*context.robots[n]);
+            context.robots[n]->tap = &m_taps[n];
+        }
+    }
+
+    ~TraceRecorder()
+    {
+        detach();
+    }
+
+    void detach()
+    {
+        for (auto &robot : m_context.robots)
+            robot->tap = nullptr;
+    }
+
+    bool write(const std::string &filename)
+    {
+        // Stop recording and save the trace, ending with every robot's
+        // current state
+        detach();
+        std::vector<char> buf;
+        put_state(buf, trace_magic);
+        save_params(buf, m_context.params());
+        put_trace_block(buf, m_start_state);
+        for (uint n = 0; n < m_taps.size(); n++)
+        {
+            // (IDs come from the World, so they aren't in the robot's state)
+            put_state(buf, m_context.robots[n]->id);
+            std::vector<char> final_state;
+            m_context.robots[n]->save_state(final_state);
+            put_trace_block(buf, final_state);
+            put_trace_block(buf, m_taps[n].events);
+        }
+        std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+        out.write(buf.data(), buf.size());
+        return out.good();
+    }
+};
+
+class TracePlayer
+{
+    // Replays a trace into freshly-built controllers, as fast as possible
+private:
+    BayesBotParams m_params;
+    std::vector<char> m_start_state;
+    std::vector<uint16_t> m_ids;
+    std::vector<std::vector<char>> m_final_states;
+    std::vector<std::vector<char>> m_events;
+    std::vector<std::unique_ptr<BayesBot>> m_robot_store;
+    std::unique_ptr<NeighborTablePool> m_neighbor_tables;
+    std::vector<ReplayTap> m_taps;
+
+public:
+    std::vector<BayesBot *> robots;
+
+    bool load(const std::string &filename)
+    {
+        // Returns false if the file isn't a valid trace
+        std::vector<char> buf;
+        if (!read_snapshot(filename, buf))
+            return false;
+        const char *pos = buf.data();
+        const char *end = buf.data() + buf.size();
+        if (buf.size() < sizeof(uint32_t) || get_state<uint32_t>(pos) != trace_magic ||
+            !load_params(pos, end, m_params))
+            return false;
+        if (!get_trace_block(pos, end, m_start_state))
+            return false;
+        uint32_t num_robots = snapshot_robot_count(m_start_state);
+        m_ids.resize(num_robots);
+        m_final_states.resize(num_robots);
+        m_events.resize(num_robots);
+        for (uint n = 0; n < num_robots; n++)
+        {
+            if (end - pos < (long)sizeof(uint16_t))
+                return false;
+            m_ids[n] = get_state<uint16_t>(pos);
+            if (!get_trace_block(pos, end, m_final_states[n]) ||
+                !get_trace_block(pos, end, m_events[n]))
+                return false;
+        }
+        return num_robots > 0;
+    }
+
+    uint32_t num_robots() const
+    {
+        return m_events.size();
+    }
+
+    bool reset(bool specialize = true)
+    {
+        // Build the controllers and load the trace's starting state
+        // Returns false if the starting state doesn't load
+        uint32_t num_robots = m_events.size();
+        m_robot_store.clear();
+        m_neighbor_tables.reset(new NeighborTablePool(
+            num_robots, NeighborTablePool::size_for_swarm(num_robots)));
+        m_taps.assign(num_robots, ReplayTap());
+        robots.resize(num_robots);
+        for (uint n = 0; n < num_robots; n++)
+        {
+            m_robot_store.emplace_back(new_bayes_bot(m_params, specialize, true));
+            robots[n] = m_robot_store[n].get();
+            robots[n]->id = m_ids[n];
+            robots[n]->params = &m_params;
+            robots[n]->attach_neighbor_table(m_neighbor_tables->table(n),
+                                             m_neighbor_tables->table_size());
+        }
+        uint32_t tick;
+        if (!restore_robots(robots, m_start_state, tick))
+            return false;
+        for (uint n = 0; n < num_robots; n++)
+        {
+            m_taps[n].start(m_events[n], robots[n]->get_kilo_ticks());
+            robots[n]->tap = &m_taps[n];
+        }
+        return true;
+    }
+
+    uint64_t play()
+    {
+        // Make every recorded call, one robot at a time (controllers only
+        // interact through the recorded messages). Returns the number of
+        // loop() calls, or 0 if a controller diverged from the trace.
+        uint64_t num_loops = 0;
+        for (uint n = 0; n < robots.size(); n++)
+        {
+            BayesBot *robot = robots[n];
+            ReplayTap &tap = m_taps[n];
+            while (!tap.done())
+            {
+                switch (tap.next_event())
+                {
+                case TRACE_LOOP:
+                    robot->replay_loop(tap.tick);
+                    num_loops++;
+                    break;
+                case TRACE_RX:
+                {
+                    message_t msg = get_state<message_t>(tap.pos);
+                    distance_measurement_t dist = get_state<distance_measurement_t>(tap.pos);
+                    robot->replay_message_rx(tap.tick, msg, dist);
+                    break;
+                }
+                case TRACE_TX:
+                    robot->replay_message_tx(tap.tick);
+                    break;
+                case TRACE_TX_SUCCESS:
+                    robot->replay_message_tx_success(tap.tick);
+                    break;
+                default:
+                    // Light reading the controller didn't ask for
+                    tap.diverged = true;
+                }
+                if (tap.diverged)
+                    return 0;
+            }
+        }
+        return num_loops;
+    }
+
+    int first_mismatch() const
+    {
+        // Index of the first robot whose state differs from the recorded
+        // final state (ignoring pose and clock), or -1 if all match
+        for (uint n = 0; n < robots.size(); n++)
+        {
+            std::vector<char> state;
+            robots[n]->save_state(state);
+            const std::vector<char> &expected = m_final_states[n];
+            if (state.size() != expected.size() ||
+                !std::equal(state.begin() + trace_unchecked_state_bytes, state.end(),
+                            expected.begin() + trace_unchecked_state_bytes))
+                return n;
+        }
+        return -1;
+    }
+};
+
+} // namespace Kilosim
+
+#endif // CONTROLLER_TRACE_HPP
@@ -0,0 +1,390 @@
+/*
+ * Initial robot positions for a trial
+ *
+ * Strategies (the `placement` config setting):
+ * - grid: square grid covering the middle 80% of the arena (the default)
+ * - jittered_grid: the same grid, with each robot moved at random within its
+ *   cell as far as it can go without touching a neighbor
+ * - poisson_disk: random positions at least a minimum distance apart, spread
+ *   evenly over the middle 80% (Bridson's algorithm)
+ * - random_uniform: uniformly random positions over the middle 80%, rejecting
+ *   any that would overlap
+ *
+ * Every strategy either places all robots without overlaps or fails with an
+ * error. Placements are checked with a spatial grid, so checking is O(n)
+ * instead of pairwise.
+ *
+ * Random placements for a trial are drawn from the trial's seed and cached,
+ * since every condition runs the same trial numbers (poisson_disk takes about
+ * 0.9 s for 50k robots).
+ */
+
+#ifndef PLACEMENT_HPP
+#define PLACEMENT_HPP
+
+#include <math.h>
+#include <stdlib.h>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+#include <kilosim/Kilobot.h>
+
+namespace Kilosim
+{
+
+typedef std::vector<std::pair<double, double>> Positions;
+
+// Kilobot body radius (mm), as in Kilosim
+const double kilobot_radius = 16.5;
+
+class PlacementGrid
+{
+    // Bins points into square cells (at least min_dist wide), so only the
+    // 3x3 cells around a point need to be searched for close neighbors
+private:
+    double m_cell_size;
+    uint m_cols, m_rows;
+    std::vector<uint> m_cell_start; // Index into m_points of each cell's points
+    std::vector<uint> m_points;
+
+    uint cell_of(double x, double y) const
+    {
+        uint col = std::min<uint>(std::max(x, 0.0) / m_cell_size, m_cols - 1);
+        uint row = std::min<uint>(std::max(y, 0.0) / m_cell_size, m_rows - 1);
+        return row * m_cols + col;
+    }
+
+public:
+    PlacementGrid(const Positions &positions, double width, double height, double min_dist)
+    {
+        // Cells are also sized to hold about one point each on average
+        m_cell_size = std::max(min_dist, sqrt(width * height / std::max<size_t>(positions.size(), 1)));
+        m_cols = std::max(1.0, ceil(width / m_cell_size));
+        m_rows = std::max(1.0, ceil(height / m_cell_size));
+
+        // Counting sort of the points by cell
+        m_cell_start.assign((size_t)m_cols * m_rows + 1, 0);
+        for (auto &pos : positions)
+            m_cell_start[cell_of(pos.first, pos.second) + 1]++;
+        for (size_t c = 1; c < m_cell_start.size(); c++)
+            m_cell_start[c] += m_cell_start[c - 1];
+        std::vector<uint> fill(m_cell_start.begin(), m_cell_start.end() - 1);
+        m_points.resize(positions.size());
+        for (uint n = 0; n < positions.size(); n++)
+            m_points[fill[cell_of(positions[n].first, positions[n].second)]++] = n;
+    }
+
+    int find_close(const Positions &positions, uint n, double min_dist) const
+    {
+        // Index of another point closer than min_dist to point n, or -1
+        int col = std::min<uint>(std::max(positions[n].first, 0.0) / m_cell_size, m_cols - 1);
+        int row = std::min<uint>(std::max(positions[n].second, 0.0) / m_cell_size, m_rows - 1);
+        for (int r = std::max(row - 1, 0); r <= std::min<int>(row + 1, m_rows - 1); r++)
+        {
+            for (int c = std::max(col - 1, 0); c <= std::min<int>(col + 1, m_cols - 1); c++)
+            {
+                uint cell = r * m_cols + c;
+                for (uint i = m_cell_start[cell]; i < m_cell_start[cell + 1]; i++)
+                {
+                    uint other = m_points[i];
+                    double dx = positions[other].first - positions[n].first;
+                    double dy = positions[other].second - positions[n].second;
+                    if (other != n && dx * dx + dy * dy < min_dist * min_dist)
+                        return other;
+                }
+            }
+        }
+        return -1;
+    }
+};
+
+inline std::string placement_error(const Positions &positions, double width, double height)
+{
+    // Check that every robot is inside the arena and none overlap, in O(n)
+    // Returns a description of the first problem found ("" if valid)
+    const double min_dist = 2 * kilobot_radius;
+    for (uint n = 0; n < positions.size(); n++)
+    {
+        double x = positions[n].first;
+        double y = positions[n].second;
+        if (x < kilobot_radius || x > width - kilobot_radius ||
+            y < kilobot_radius || y > height - kilobot_radius)
+        {
+            std::ostringstream msg;
+            msg << "Robot " << n << " at (" << x << ", " << y << ") is outside the arena";
+            return msg.str();
+        }
+    }
+    PlacementGrid grid(positions, width, height, min_dist);
+    for (uint n = 0; n < positions.size(); n++)
+    {
+        int other = grid.find_close(positions, n, min_dist);
+        if (other >= 0)
+        {
+            std::ostringstream msg;
+            msg << "Robots " << n << " and " << other << " overlap";
+            return msg.str();
+        }
+    }
+    return "";
+}
+
+class Placement
+{
+private:
+    std::string m_strategy;
+    double m_width, m_height;
+    // Fraction of the arena's width/height robots are placed in
+    const double m_cover = 0.8;
+    // Smallest allowed distance between robot centers
+    const double m_min_dist = 2 * kilobot_radius;
+    // Placements already drawn, by (seed, number of robots), up to
+    // max_cached_robots robots in total
+    mutable std::map<std::pair<unsigned long, uint>, Positions> m_cache;
+    mutable size_t m_cached_robots = 0;
+    static const size_t max_cached_robots = 1 << 24;
+
+    static void placement_failed(const std::string &msg)
+    {
+        std::cout << "ERROR: " << msg << std::endl;
+        exit(1);
+    }
+
+    void grid_layout(uint num_robots, uint &num_rows, double &x_spacing, double &y_spacing,
+                     double &x_offset, double &y_offset) const
+    {
+        // Grid over the middle of the arena, or over all of it if the robots
+        // wouldn't fit in the middle without touching
+        num_rows = ceil(sqrt(num_robots));
+        double cover = m_cover;
+        if (cover * std::min(m_width, m_height) / num_rows < m_min_dist)
+            cover = 1 - 2 * kilobot_radius / std::min(m_width, m_height);
+        x_spacing = cover * m_width / num_rows;
+        y_spacing = cover * m_height / num_rows;
+        x_offset = m_width * (1.0 - cover) / 2;
+        y_offset = m_height * (1.0 - cover) / 2;
+        if (std::min(x_spacing, y_spacing) < m_min_dist)
+        {
+            placement_failed("Too many robots (" + std::to_string(num_robots) +
+                             ") to fit on a grid in the arena");
+        }
+    }
+
+    Positions grid(uint num_robots, bool jitter) const
+    {
+        uint num_rows;
+        double x_spacing, y_spacing, x_offset, y_offset;
+        grid_layout(num_robots, num_rows, x_spacing, y_spacing, x_offset, y_offset);
+        // Moving each robot by at most half of the spare room between
+        // neighbors keeps them at least m_min_dist apart
+        double x_jitter = jitter ? (x_spacing - m_min_dist) / 2 : 0;
+        double y_jitter = jitter ? (y_spacing - m_min_dist) / 2 : 0;
+        Positions positions(num_robots);
+        for (uint n = 0; n < num_robots; n++)
+        {
+            positions[n] = std::make_pair((n / num_rows + 0.5) * x_spacing + x_offset,
+                                          (n % num_rows + 0.5) * y_spacing + y_offset);
+            if (jitter)
+            {
+                positions[n].first += uniform_rand_real(-x_jitter, x_jitter);
+                positions[n].second += uniform_rand_real(-y_jitter, y_jitter);
+            }
+        }
+        return positions;
+    }
+
+    Positions random_uniform(uint num_robots) const
+    {
+        // Random sequential addition, checking each new robot against the
+        // ones already placed in a grid of cells (one robot per cell at most)
+        const uint max_attempts = 1000;
+        const double cell_size = m_min_dist / sqrt(2);
+        const double x_min = m_width * (1 - m_cover) / 2;
+        const double y_min = m_height * (1 - m_cover) / 2;
+        const uint cols = ceil(m_cover * m_width / cell_size);
+        const uint rows = ceil(m_cover * m_height / cell_size);
+        std::vector<int> cells((size_t)cols * rows, -1);
+        Positions positions;
+        positions.reserve(num_robots);
+        for (uint n = 0; n < num_robots; n++)
+        {
+            uint attempt = 0;
+            for (; attempt < max_attempts; attempt++)
+            {
+                double x = uniform_rand_real(x_min, x_min + m_cover * m_width);
+                double y = uniform_rand_real(y_min, y_min + m_cover * m_height);
+                if (try_add(positions, cells, cols, rows, cell_size, x_min, y_min, x, y, m_min_dist))
+                    break;
+            }
+            if (attempt == max_attempts)
+            {
+                placement_failed("Could not place " + std::to_string(num_robots) +
+                                 " robots at random without overlaps (try jittered_grid)");
+            }
+        }
+        return positions;
+    }
+
+    Positions poisson_disk(uint num_robots) const
+    {
+        // Bridson's algorithm over the middle of the arena, with the spacing
+        // chosen to produce somewhat more points than needed. A random subset
+        // of num_robots of them is kept.
+        const uint attempts_per_point = 30;
+        const double x_min = m_width * (1 - m_cover) / 2;
+        const double y_min = m_height * (1 - m_cover) / 2;
+        const double area = m_cover * m_width * m_cover * m_height;
+        // (A maximal Poisson-disk set with spacing d has about one point per
+        // 1.3 d^2, so aim for 20% extra)
+        double min_dist = std::max(m_min_dist, sqrt(area / (1.3 * 1.2 * num_robots)));
+        Positions points;
+        while (true)
+        {
+            points = bridson(min_dist, x_min, y_min, attempts_per_point);
+            if (points.size() >= num_robots)
+                break;
+            if (min_dist <= m_min_dist)
+            {
+                placement_failed("Could not fit " + std::to_string(num_robots) +
+                                 " robots with poisson_disk placement (try jittered_grid)");
+            }
+            min_dist = std::max(m_min_dist, min_dist * 0.9);
+        }
+        // Partial Fisher-Yates shuffle to pick the subset
+        for (uint n = 0; n < num_robots; n++)
+        {
+            uint pick = std::min<uint>(uniform_rand_real(n, points.size()), points.size() - 1);
+            std::swap(points[n], points[pick]);
+        }
+        points.resize(num_robots);
+        return points;
+    }
+
+    Positions bridson(double min_dist, double x_min, double y_min, uint attempts_per_point) const
+    {
+        const double cell_size = min_dist / sqrt(2);
+        const uint cols = ceil(m_cover * m_width / cell_size);
+        const uint rows = ceil(m_cover * m_height / cell_size);
+        std::vector<int> cells((size_t)cols * rows, -1);
+        Positions points;
+        try_add(points, cells, cols, rows, cell_size, x_min, y_min,
+                uniform_rand_real(x_min, x_min + m_cover * m_width),
+                uniform_rand_real(y_min, y_min + m_cover * m_height), min_dist);
+        std::vector<uint> active = {0};
+        while (!active.empty())
+        {
+            uint a = std::min<uint>(uniform_rand_real(0, active.size()), active.size() - 1);
+            std::pair<double, double> center = points[active[a]];
+            bool added = false;
+            for (uint k = 0; k < attempts_per_point && !added; k++)
+            {
+                // Candidate in the annulus between min_dist and 2 * min_dist
+                double angle = uniform_rand_real(0, 2 * PI);
+                double dist = min_dist * sqrt(uniform_rand_real(1, 4));
+                double x = center.first + dist * cos(angle);
+                double y = center.second + dist * sin(angle);
+                if (x < x_min || x >= x_min + m_cover * m_width ||
+                    y < y_min || y >= y_min + m_cover * m_height)
+                    continue;
+                added = try_add(points, cells, cols, rows, cell_size, x_min, y_min, x, y, min_dist);
+            }
+            if (added)
+            {
+                active.push_back(points.size() - 1);
+            }
+            else
+            {
+                active[a] = active.back();
+                active.pop_back();
+            }
+        }
+        return points;
+    }
+
+    static bool try_add(Positions &points, std::vector<int> &cells, uint cols, uint rows,
+                        double cell_size, double x_min, double y_min,
+                        double x, double y, double min_dist)
+    {
+        // Add (x, y) if it's at least min_dist from every point so far. Cells
+        // are min_dist / sqrt(2) wide, so each holds at most one point and
+        // only the 5x5 cells around (x, y) can be too close.
+        int col = std::min<uint>((x - x_min) / cell_size, cols - 1);
+        int row = std::min<uint>((y - y_min) / cell_size, rows - 1);
+        for (int r = std::max(row - 2, 0); r <= std::min<int>(row + 2, rows - 1); r++)
+        {
+            for (int c = std::max(col - 2, 0); c <= std::min<int>(col + 2, cols - 1); c++)
+            {
+                int other = cells[(size_t)r * cols + c];
+                if (other < 0)
+                    continue;
+                double dx = points[other].first - x;
+                double dy = points[other].second - y;
+                if (dx * dx + dy * dy < min_dist * min_dist)
+                    return false;
+            }
+        }
+        cells[(size_t)row * cols + col] = points.size();
+        points.push_back(std::make_pair(x, y));
+        return true;
+    }
+
+public:
+    Placement(const std::string strategy, double world_width, double world_height)
+        : m_strategy(strategy), m_width(world_width), m_height(world_height)
+    {
+        if (strategy != "grid" && strategy != "jittered_grid" &&
+            strategy != "poisson_disk" && strategy != "random_uniform")
+        {
+            placement_failed("Unknown placement \"" + strategy +
+                             "\" (must be grid, jittered_grid, poisson_disk, or random_uniform)");
+        }
+    }
+
+    bool is_random() const
+    {
+        // Whether positions change from trial to trial
+        return m_strategy != "grid";
+    }
+
+    Positions place(uint num_robots) const
+    {
+        // Random strategies draw from the global random generator (seed it
+        // first to make them repeatable)
+        Positions positions;
+        if (m_strategy == "jittered_grid")
+            positions = grid(num_robots, true);
+        else if (m_strategy == "poisson_disk")
+            positions = poisson_disk(num_robots);
+        else if (m_strategy == "random_uniform")
+            positions = random_uniform(num_robots);
+        else
+            positions = grid(num_robots, false);
+        return positions;
+    }
+
+    const Positions &place_trial(uint num_robots, unsigned long seed) const
+    {
+        // Positions for the trial with this seed (reseeds the global random
+        // generator only if they aren't cached, so reseed it afterwards)
+        auto key = std::make_pair(seed, num_robots);
+        auto it = m_cache.find(key);
+        if (it != m_cache.end())
+            return it->second;
+        seed_rand(seed);
+        if (m_cached_robots + num_robots > max_cached_robots)
+        {
+            // Full, so only keep the latest
+            m_cache.clear();
+            m_cached_robots = 0;
+        }
+        m_cached_robots += num_robots;
+        return m_cache[key] = place(num_robots);
+    }
+};
+
+} // namespace Kilosim
+
+#endif // PLACEMENT_HPP
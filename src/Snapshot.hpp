@@ -0,0 +1,152 @@
+/*
+ * Binary snapshots of a running trial
+ *
+ * A snapshot holds the World clock and every robot's pose and controller
+ * state (see BayesBot::save_state), which is enough to continue the trial
+ * exactly where it left off. Snapshots are captured in memory during the
+ * trial and written to disk on a background thread.
+ */
+
+#ifndef SNAPSHOT_HPP
+#define SNAPSHOT_HPP
+
+#include "TrialContext.hpp"
+
+#include <stdio.h>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Kilosim
+{
+
+// File identifier and format version ("KSN" + 4)
+const uint32_t snapshot_magic = 0x044e534b;
+
+inline std::vector<char> capture_snapshot(TrialContext &context)
+{
+    std::vector<char> buf;
+    put_state(buf, snapshot_magic);
+    put_state(buf, (uint32_t)context.world.get_tick());
+    put_state(buf, (uint32_t)context.robots.size());
+    for (auto &robot : context.robots)
+    {
+        robot->save_state(buf);
+    }
+    return buf;
+}
+
+inline bool restore_robots(std::vector<BayesBot *> &robots, const std::vector<char> &buf,
+                           uint32_t &tick)
+{
+    // Load a snapshot's controller states into robots that have been reset
+    // and attached to neighbor tables, and get the tick it was taken at
+    // Returns false if the snapshot doesn't match the robots or is cut short
+    const char *pos = buf.data();
+    const char *end = buf.data() + buf.size();
+    if (buf.size() < 3 * sizeof(uint32_t) ||
+        get_state<uint32_t>(pos) != snapshot_magic)
+        return false;
+    tick = get_state<uint32_t>(pos);
+    if (get_state<uint32_t>(pos) != robots.size())
+        return false;
+    for (auto &robot : robots)
+    {
+        if (!robot->load_state(pos, end))
+            return false;
+    }
+    return pos == end;
+}
+
+inline bool restore_snapshot(TrialContext &context, const std::vector<char> &buf)
+{
+    // Restore a snapshot into a context that has already begun its trial
+    // Returns false if the snapshot doesn't match this context
+    uint32_t tick;
+    if (!restore_robots(context.robots, buf, tick))
+        return false;
+    context.world.set_tick(tick);
+    return true;
+}
+
+inline uint32_t snapshot_robot_count(const std::vector<char> &buf)
+{
+    // Number of robots in a snapshot (0 if it isn't a snapshot)
+    const char *pos = buf.data();
+    if (buf.size() < 3 * sizeof(uint32_t) || get_state<uint32_t>(pos) != snapshot_magic)
+        return 0;
+    get_state<uint32_t>(pos);
+    return get_state<uint32_t>(pos);
+}
+
+inline uint32_t snapshot_tick(const std::vector<char> &buf)
+{
+    // World tick a snapshot was taken at (0 if it isn't a snapshot)
+    const char *pos = buf.data();
+    if (buf.size() < 2 * sizeof(uint32_t) || get_state<uint32_t>(pos) != snapshot_magic)
+        return 0;
+    return get_state<uint32_t>(pos);
+}
+
+inline bool read_snapshot(const std::string &filename, std::vector<char> &buf)
+{
+    std::ifstream in(filename, std::ios::binary);
+    if (!in.good())
+        return false;
+    buf.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    return true;
+}
+
+class SnapshotWriter
+{
+    // Writes snapshots in the background so the simulation doesn't wait on
+    // disk. Only one write is in flight at a time.
+private:
+    std::thread m_thread;
+
+public:
+    ~SnapshotWriter()
+    {
+        wait();
+    }
+
+    void write(const std::string filename, std::vector<char> buf)
+    {
+        wait();
+        m_thread = std::thread(write_file, filename, std::move(buf));
+    }
+
+    void wait()
+    {
+        if (m_thread.joinable())
+            m_thread.join();
+    }
+
+private:
+    static void write_file(const std::string filename, const std::vector<char> buf)
+    {
+        // Write to a temporary file first and only replace the last snapshot
+        // if every byte made it out, so a crash or full disk never leaves a
+        // truncated snapshot behind
+        std::string tmp_filename = filename + ".tmp";
+        std::ofstream out(tmp_filename, std::ios::binary | std::ios::trunc);
+        out.write(buf.data(), buf.size());
+        out.close();
+        if (out.good())
+        {
+            rename(tmp_filename.c_str(), filename.c_str());
+        }
+        else
+        {
+            std::cout << "WARNING: Could not write snapshot " << filename << std::endl;
+            remove(tmp_filename.c_str());
+        }
+    }
+};
+
+} // namespace Kilosim
+
+#endif // SNAPSHOT_HPP
@@ -0,0 +1,478 @@
+/*
+ * Summaries of the decisions logged by a sweep
+ *
+ * Reads the `decision` time series of every trial in a sweep's log files and
+ * reduces each (condition, fill ratio) to accuracy and undecided fraction over
+ * time, and the distribution of times until a given fraction of the robots has
+ * decided. Used by kilosim_analyze (see analyze.cpp).
+ *
+ * Log files are named `<condition>-<fill ratio>.h5` (see SweepPlan) and hold a
+ * `trial_<n>` group per trial with `time` and `decision` datasets, one row of
+ * robot values per log point. Rows logged before a trial was resumed from a
+ * snapshot are in `trial_<n>_until_tick_<t>` groups.
+ */
+
+#ifndef SWEEP_ANALYSIS_HPP
+#define SWEEP_ANALYSIS_HPP
+
+#include <hdf5.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <map>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace Kilosim
+{
+
+typedef struct TrialCurve
+{
+    // One trial's decisions at each log point
+    std::vector<double> time;
+    std::vector<double> accuracy;  // Fraction of robots with the correct decision
+    std::vector<double> undecided; // Fraction of robots still undecided
+} TrialCurve;
+
+typedef struct LogFile
+{
+    std::string filename;
+    std::string condition_label;
+    std::string fill_ratio_str;
+    double fill_ratio;
+    std::vector<TrialCurve> trials;
+} LogFile;
+
+inline bool parse_log_filename(const std::string &path, LogFile &log)
+{
+    // Split "<dir>/<condition>-<fill ratio>.h5" into its parts
+    // Returns false for files that don't look like sweep logs
+    size_t base = path.rfind('/');
+    std::string name = path.substr(base == std::string::npos ? 0 : base + 1);
+    if (name.size() < 4 || name.compare(name.size() - 3, 3, ".h5") != 0)
+        return false;
+    name = name.substr(0, name.size() - 3);
+    size_t dash = name.rfind('-');
+    if (dash == std::string::npos || dash == 0)
+        return false;
+    char *end;
+    std::string fill_ratio_str = name.substr(dash + 1);
+    double fill_ratio = strtod(fill_ratio_str.c_str(), &end);
+    if (fill_ratio_str.empty() || *end != '\0')
+        return false;
+    log.filename = path;
+    log.condition_label = name.substr(0, dash);
+    log.fill_ratio_str = fill_ratio_str;
+    log.fill_ratio = fill_ratio;
+    return true;
+}
+
+class LogReader
+{
+    // Reads the trials of sweep log files. The HDF5 library isn't safe to
+    // call from several threads at once (and the thread-safe build runs one
+    // call at a time), so kilosim_analyze reads files in parallel with one
+    // process per file instead.
+private:
+    typedef struct TrialGroup
+    {
+        std::string name;
+        uint trial;
+        int64_t until_tick; // -1 for the trial's (complete) group
+    } TrialGroup;
+
+    static bool parse_trial_group(const std::string &name, TrialGroup &group)
+    {
+        // "trial_<n>", or "trial_<n>_until_tick_<t>" for the rows logged
+        // before the trial was resumed from a snapshot
+        const std::string until = "_until_tick_";
+        if (name.compare(0, 6, "trial_") != 0)
+            return false;
+        size_t digits_end = name.find_first_not_of("0123456789", 6);
+        if (digits_end == 6)
+            return false;
+        group.name = name;
+        group.trial = std::stoul(name.substr(6, digits_end - 6));
+        group.until_tick = -1;
+        if (digits_end == std::string::npos)
+            return true;
+        size_t tick_start = digits_end + until.size();
+        if (name.compare(digits_end, until.size(), until) != 0 || tick_start == name.size() ||
+            name.find_first_not_of("0123456789", tick_start) != std::string::npos)
+            return false;
+        group.until_tick = std::stoll(name.substr(tick_start));
+        return true;
+    }
+
+    std::vector<TrialGroup> trial_groups(hid_t file)
+    {
+        std::vector<TrialGroup> groups;
+        H5G_info_t info;
+        if (H5Gget_info(file, &info) < 0)
+            return groups;
+        for (hsize_t i = 0; i < info.nlinks; i++)
+        {
+            char name[256];
+            TrialGroup group;
+            if (H5Lget_name_by_idx(file, ".", H5_INDEX_NAME, H5_ITER_INC, i,
+                                   name, sizeof(name), H5P_DEFAULT) > 0 &&
+                parse_trial_group(name, group))
+                groups.push_back(group);
+        }
+        return groups;
+    }
+
+    double read_restored_from_time(hid_t group)
+    {
+        // Time a resumed trial's rows start at (NAN if it wasn't resumed)
+        if (H5Lexists(group, "params", H5P_DEFAULT) <= 0 ||
+            H5Lexists(group, "params/restored_from_time", H5P_DEFAULT) <= 0)
+            return NAN;
+        hid_t dataset = H5Dopen2(group, "params/restored_from_time", H5P_DEFAULT);
+        if (dataset < 0)
+            return NAN;
+        double time;
+        if (H5Dread(dataset, H5T_NATIVE_DOUBLE, H5S_ALL, H5S_ALL, H5P_DEFAULT, &time) < 0)
+            time = NAN;
+        H5Dclose(dataset);
+        return time;
+    }
+
+    bool read_time(hid_t group, std::vector<double> &time)
+    {
+        hid_t dataset = H5Dopen2(group, "time", H5P_DEFAULT);
+        if (dataset < 0)
+            return false;
+        hid_t space = H5Dget_space(dataset);
+        hssize_t num_points = H5Sget_simple_extent_npoints(space);
+        time.resize(num_points > 0 ? num_points : 0);
+        herr_t status = H5Dread(dataset, H5T_NATIVE_DOUBLE, H5S_ALL, H5S_ALL,
+                                H5P_DEFAULT, time.data());
+        H5Sclose(space);
+        H5Dclose(dataset);
+        return status >= 0;
+    }
+
+    bool read_decisions(hid_t group, int correct_decision, TrialCurve &curve)
+    {
+        // Stream the (log points x robots) decision dataset a chunk of rows at
+        // a time, so each chunk is read from disk (and decompressed) once
+        hsize_t dims[2] = {0, 0};
+        hid_t dataset = H5Dopen2(group, "decision", H5P_DEFAULT);
+        if (dataset < 0)
+            return false;
+        hid_t space = H5Dget_space(dataset);
+        if (H5Sget_simple_extent_ndims(space) != 2)
+        {
+            H5Sclose(space);
+            H5Dclose(dataset);
+            return false;
+        }
+        H5Sget_simple_extent_dims(space, dims, NULL);
+        hsize_t rows_per_block = dims[0];
+        hid_t create_plist = H5Dget_create_plist(dataset);
+        hsize_t chunk_dims[2];
+        if (H5Pget_layout(create_plist) == H5D_CHUNKED &&
+            H5Pget_chunk(create_plist, 2, chunk_dims) == 2 && chunk_dims[0] > 0)
+            rows_per_block = chunk_dims[0];
+        H5Pclose(create_plist);
+
+        const hsize_t num_robots = dims[1];
+        std::vector<double> block(rows_per_block * num_robots);
+        bool ok = num_robots > 0;
+        for (hsize_t row = 0; ok && row < dims[0]; row += rows_per_block)
+        {
+            hsize_t num_rows = std::min(rows_per_block, dims[0] - row);
+            hsize_t start[2] = {row, 0};
+            hsize_t count[2] = {num_rows, num_robots};
+            H5Sselect_hyperslab(space, H5S_SELECT_SET, start, NULL, count, NULL);
+            hid_t mem_space = H5Screate_simple(2, count, NULL);
+            ok = H5Dread(dataset, H5T_NATIVE_DOUBLE, mem_space, space,
+                         H5P_DEFAULT, block.data()) >= 0;
+            H5Sclose(mem_space);
+            for (hsize_t r = 0; ok && r < num_rows; r++)
+            {
+                uint correct = 0;
+                uint undecided = 0;
+                const double *decisions = &block[r * num_robots];
+                for (hsize_t n = 0; n < num_robots; n++)
+                {
+                    if (decisions[n] == -1)
+                        undecided++;
+                    else if (decisions[n] == correct_decision)
+                        correct++;
+                }
+                curve.accuracy.push_back((double)correct / num_robots);
+                curve.undecided.push_back((double)undecided / num_robots);
+            }
+        }
+
+        H5Sclose(space);
+        H5Dclose(dataset);
+        return ok;
+    }
+
+public:
+    bool read_trial(hid_t file, const std::string &name, int correct_decision,
+                    TrialCurve &curve, double &start_time)
+    {
+        // Read one trial group, and the time its rows start from
+        hid_t group = H5Gopen2(file, name.c_str(), H5P_DEFAULT);
+        if (group < 0)
+            return false;
+        bool ok = read_time(group, curve.time) &&
+                  read_decisions(group, correct_decision, curve);
+        if (ok)
+        {
+            // (Guard against a time series cut short by an interruption)
+            size_t num_rows = std::min(curve.time.size(), curve.accuracy.size());
+            curve.time.resize(num_rows);
+            curve.accuracy.resize(num_rows);
+            curve.undecided.resize(num_rows);
+            start_time = read_restored_from_time(group);
+            if (isnan(start_time))
+                start_time = num_rows > 0 ? curve.time[0] : 0;
+        }
+        H5Gclose(group);
+        return ok;
+    }
+
+    static void prepend_rows(TrialCurve &curve, const TrialCurve &earlier, double until_time)
+    {
+        // Put the rows of earlier logged up to until_time in front of curve.
+        // The row at until_time itself is only in earlier: it was logged just
+        // before the snapshot was taken, and the resumed run's first row is
+        // one log point later.
+        size_t num_rows = 0;
+        while (num_rows < earlier.time.size() && earlier.time[num_rows] <= until_time)
+            num_rows++;
+        curve.time.insert(curve.time.begin(), earlier.time.begin(), earlier.time.begin() + num_rows);
+        curve.accuracy.insert(curve.accuracy.begin(), earlier.accuracy.begin(),
+                              earlier.accuracy.begin() + num_rows);
+        curve.undecided.insert(curve.undecided.begin(), earlier.undecided.begin(),
+                               earlier.undecided.begin() + num_rows);
+    }
+
+public:
+    bool read(LogFile &log)
+    {
+        // Read every complete trial in a log file. A trial resumed from a
+        // snapshot gets the rows its earlier run(s) logged before it was
+        // resumed, so it's analyzed from time 0.
+        // Returns false if the file can't be opened
+        hid_t file = H5Fopen(log.filename.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+        if (file < 0)
+            return false;
+
+        // Partial groups of each trial, latest first
+        std::vector<TrialGroup> groups = trial_groups(file);
+        std::map<uint, std::vector<const TrialGroup *>> partial_groups;
+        for (auto &group : groups)
+        {
+            if (group.until_tick >= 0)
+                partial_groups[group.trial].push_back(&group);
+        }
+        for (auto &entry : partial_groups)
+        {
+            std::sort(entry.second.begin(), entry.second.end(),
+                      [](const TrialGroup *a, const TrialGroup *b) {
+                          return a->until_tick > b->until_tick;
+                      });
+        }
+
+        // Same rule as the simulation: the majority color is correct
+        int correct_decision = log.fill_ratio >= 0.5 ? 1 : 0;
+        for (auto &group : groups)
+        {
+            if (group.until_tick >= 0)
+                continue;
+            TrialCurve curve;
+            double start_time;
+            if (!read_trial(file, group.name, correct_decision, curve, start_time))
+                continue;
+            for (auto partial : partial_groups[group.trial])
+            {
+                TrialCurve earlier;
+                double earlier_start_time;
+                if (start_time <= 0)
+                    break;
+                if (!read_trial(file, partial->name, correct_decision, earlier, earlier_start_time))
+                    continue;
+                prepend_rows(curve, earlier, start_time);
+                start_time = std::min(start_time, earlier_start_time);
+            }
+            if (!curve.time.empty())
+                log.trials.push_back(curve);
+        }
+
+        H5Fclose(file);
+        return true;
+    }
+};
+
+inline std::vector<char> encode_trials(const std::vector<TrialCurve> &trials)
+{
+    // Flatten a log file's curves into bytes (to send between processes)
+    std::vector<char> buf;
+    auto put = [&buf](const void *data, size_t size) {
+        buf.insert(buf.end(), (const char *)data, (const char *)data + size);
+    };
+    uint32_t num_trials = trials.size();
+    put(&num_trials, sizeof(num_trials));
+    for (auto &trial : trials)
+    {
+        uint32_t num_rows = trial.time.size();
+        put(&num_rows, sizeof(num_rows));
+        put(trial.time.data(), num_rows * sizeof(double));
+        put(trial.accuracy.data(), num_rows * sizeof(double));
+        put(trial.undecided.data(), num_rows * sizeof(double));
+    }
+    return buf;
+}
+
+inline bool decode_trials(const std::vector<char> &buf, std::vector<TrialCurve> &trials)
+{
+    // Inverse of encode_trials. Returns false if buf is cut short.
+    const char *pos = buf.data();
+    const char *end = buf.data() + buf.size();
+    auto get = [&pos, end](void *data, size_t size) {
+        if ((size_t)(end - pos) < size)
+            return false;
+        memcpy(data, pos, size);
+        pos += size;
+        return true;
+    };
+    uint32_t num_trials;
+    if (!get(&num_trials, sizeof(num_trials)))
+        return false;
+    trials.resize(num_trials);
+    for (auto &trial : trials)
+    {
+        uint32_t num_rows;
+        if (!get(&num_rows, sizeof(num_rows)))
+            return false;
+        trial.time.resize(num_rows);
+        trial.accuracy.resize(num_rows);
+        trial.undecided.resize(num_rows);
+        if (!get(trial.time.data(), num_rows * sizeof(double)) ||
+            !get(trial.accuracy.data(), num_rows * sizeof(double)) ||
+            !get(trial.undecided.data(), num_rows * sizeof(double)))
+            return false;
+    }
+    return pos == end;
+}
+
+inline double decided_time(const TrialCurve &curve, double decided_fraction)
+{
+    // First logged time when at least decided_fraction of the robots had
+    // decided (NAN if it never happened)
+    for (size_t i = 0; i < curve.time.size(); i++)
+    {
+        if (1 - curve.undecided[i] >= decided_fraction - 1e-9)
+            return curve.time[i];
+    }
+    return NAN;
+}
+
+inline double percentile(std::vector<double> vals, double p)
+{
+    // Linear interpolation between closest ranks (NAN if empty)
+    if (vals.empty())
+        return NAN;
+    std::sort(vals.begin(), vals.end());
+    double rank = p * (vals.size() - 1);
+    size_t below = (size_t)rank;
+    if (below + 1 >= vals.size())
+        return vals.back();
+    return vals[below] + (rank - below) * (vals[below + 1] - vals[below]);
+}
+
+inline void write_accuracy_curves(std::ostream &out, const std::vector<LogFile> &logs)
+{
+    // Mean accuracy and undecided fraction across trials at every logged
+    // time. Trials that ended early (all decided) hold their last values.
+    out << "condition\tfill_ratio\ttime\ttrials\taccuracy\tundecided\n";
+    for (auto &log : logs)
+    {
+        std::vector<double> times;
+        for (auto &trial : log.trials)
+            times.insert(times.end(), trial.time.begin(), trial.time.end());
+        std::sort(times.begin(), times.end());
+        times.erase(std::unique(times.begin(), times.end()), times.end());
+
+        std::vector<size_t> inds(log.trials.size(), 0);
+        for (double t : times)
+        {
+            uint num_trials = 0;
+            double accuracy = 0;
+            double undecided = 0;
+            for (size_t k = 0; k < log.trials.size(); k++)
+            {
+                const TrialCurve &trial = log.trials[k];
+                // (A trial resumed from a snapshot starts part way through)
+                if (trial.time[0] > t)
+                    continue;
+                while (inds[k] + 1 < trial.time.size() && trial.time[inds[k] + 1] <= t)
+                    inds[k]++;
+                num_trials++;
+                accuracy += trial.accuracy[inds[k]];
+                undecided += trial.undecided[inds[k]];
+            }
+            if (num_trials == 0)
+                continue;
+            out << log.condition_label << '\t' << log.fill_ratio_str << '\t'
+                << t << '\t' << num_trials << '\t'
+                << accuracy / num_trials << '\t' << undecided / num_trials << '\n';
+        }
+    }
+}
+
+inline void write_analysis_summary(std::ostream &out, const std::vector<LogFile> &logs,
+                                   const std::vector<double> &decided_fractions)
+{
+    // One line per log file: final accuracy and undecided fraction, and the
+    // distribution (10th/50th/90th percentiles) of time until each fraction
+    // of the robots decided, over the trials that got there
+    out << "condition\tfill_ratio\ttrials\taccuracy\tundecided";
+    for (double fraction : decided_fractions)
+    {
+        std::string name = "t" + std::to_string((int)round(fraction * 100));
+        out << '\t' << name << "_reached\t" << name << "_p10\t"
+            << name << "_median\t" << name << "_p90";
+    }
+    out << '\n';
+    for (auto &log : logs)
+    {
+        double accuracy = 0;
+        double undecided = 0;
+        for (auto &trial : log.trials)
+        {
+            accuracy += trial.accuracy.back();
+            undecided += trial.undecided.back();
+        }
+        uint num_trials = log.trials.size();
+        out << log.condition_label << '\t' << log.fill_ratio_str << '\t' << num_trials << '\t'
+            << (num_trials > 0 ? accuracy / num_trials : NAN) << '\t'
+            << (num_trials > 0 ? undecided / num_trials : NAN);
+        for (double fraction : decided_fractions)
+        {
+            std::vector<double> times;
+            for (auto &trial : log.trials)
+            {
+                double t = decided_time(trial, fraction);
+                if (!isnan(t))
+                    times.push_back(t);
+            }
+            out << '\t' << times.size() << '\t' << percentile(times, 0.1) << '\t'
+                << percentile(times, 0.5) << '\t' << percentile(times, 0.9);
+        }
+        out << '\n';
+    }
+}
+
+} // namespace Kilosim
+
+#endif // SWEEP_ANALYSIS_HPP
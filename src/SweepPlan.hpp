@@ -0,0 +1,212 @@
+/*
+ * Expand a config file into a flat list of trials to run
+ *
+ * `compare_param` may name one swept key or a list of them. Every swept key
+ * holds an array of values in the config, and a condition is one combination
+ * of values across all of the swept keys (the full Cartesian grid). Each
+ * condition is run for every fill ratio and trial, giving one job per trial.
+ * The config is parsed and validated once, up front.
+ */
+
+#ifndef SWEEP_PLAN_HPP
+#define SWEEP_PLAN_HPP
+
+#include <stdlib.h>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <kilosim/ConfigParser.h>
+
+namespace Kilosim
+{
+
+// Parameters that are allowed to differ between conditions
+const std::vector<std::string> condition_keys = {
+    "use_positive_feedback",
+    "log_freq",
+    "num_robots",
+    "credible_thresh",
+    "allow_simultaneity",
+    "observe_step_time",
+    "both_prior",
+    "controller_period",
+    "tx_policy",
+    "tx_period",
+    "tx_keepalive",
+    "tx_duty_cycle",
+};
+
+typedef struct SweepCondition
+{
+    // Scalar value of every condition key (and every swept key)
+    nlohmann::json params;
+    // Values of the swept keys only, in the order of SweepPlan::swept_keys
+    std::vector<nlohmann::json> swept_vals;
+    // Identifies the condition in log file names, e.g. "num_robots=100"
+    std::string label;
+} SweepCondition;
+
+typedef struct TrialJob
+{
+    // One trial of one condition at one fill ratio
+    uint condition_ind;
+    uint fill_ind;
+    uint trial;
+} TrialJob;
+
+class SweepPlan
+{
+public:
+    std::vector<std::string> swept_keys;
+    std::vector<SweepCondition> conditions;
+    std::vector<double> fill_ratios;
+    std::vector<TrialJob> jobs;
+
+    SweepPlan(ConfigParser &config, uint max_trials = 0)
+    {
+        // If max_trials is given, plan that many trials per condition and
+        // fill ratio instead of num_trials (for adaptive sampling)
+        nlohmann::json compare_param = config.get("compare_param");
+        if (compare_param.is_array())
+        {
+            for (auto &key : compare_param)
+                swept_keys.push_back(key.get<std::string>());
+        }
+        else
+        {
+            swept_keys.push_back(compare_param.get<std::string>());
+        }
+
+        // Values for every swept key, checked before anything runs
+        std::vector<nlohmann::json> swept_vals(swept_keys.size());
+        for (uint k = 0; k < swept_keys.size(); k++)
+        {
+            swept_vals[k] = config.get(swept_keys[k]);
+            if (!swept_vals[k].is_array() || swept_vals[k].empty())
+            {
+                config_error("Swept parameter \"" + swept_keys[k] +
+                             "\" must be a non-empty list of values");
+            }
+        }
+        nlohmann::json scalar_params;
+        for (auto &key : condition_keys)
+        {
+            if (is_swept(key))
+                continue;
+            scalar_params[key] = config.get(key);
+            if (scalar_params[key].is_array())
+            {
+                config_error("\"" + key + "\" is a list but is not in compare_param");
+            }
+        }
+
+        // Expand the Cartesian grid (last swept key varies fastest)
+        std::vector<uint> inds(swept_keys.size(), 0);
+        bool done = false;
+        while (!done)
+        {
+            SweepCondition condition;
+            condition.params = scalar_params;
+            std::ostringstream label;
+            for (uint k = 0; k < swept_keys.size(); k++)
+            {
+                nlohmann::json val = swept_vals[k][inds[k]];
+                condition.params[swept_keys[k]] = val;
+                condition.swept_vals.push_back(val);
+                // (Strings without their JSON quotes, since labels name files)
+                label << (k > 0 ? "," : "") << swept_keys[k] << '='
+                      << (val.is_string() ? val.get<std::string>() : val.dump());
+            }
+            condition.label = label.str();
+            conditions.push_back(condition);
+
+            // Advance the odometer of swept value indices
+            done = true;
+            for (int k = swept_keys.size() - 1; k >= 0; k--)
+            {
+                if (++inds[k] < swept_vals[k].size())
+                {
+                    done = false;
+                    break;
+                }
+                inds[k] = 0;
+            }
+        }
+
+        fill_ratios = config.get("fill_ratios").get<std::vector<double>>();
+        const uint start_trial = config.get("start_trial");
+        const uint num_trials = max_trials > 0 ? max_trials : (uint)config.get("num_trials");
+        for (uint c = 0; c < conditions.size(); c++)
+        {
+            for (uint f = 0; f < fill_ratios.size(); f++)
+            {
+                for (uint trial = start_trial; trial < (num_trials + start_trial); trial++)
+                {
+                    jobs.push_back({c, f, trial});
+                }
+            }
+        }
+    }
+
+    bool is_swept(const std::string &key) const
+    {
+        for (auto &swept_key : swept_keys)
+        {
+            if (swept_key == key)
+                return true;
+        }
+        return false;
+    }
+
+    void shard(uint shard_ind, uint num_shards)
+    {
+        // Keep every num_shards-th (condition, fill ratio) cell, round robin.
+        // Each cell has its own log file, so this gives every file a single
+        // writer when shards share a log_dir.
+        std::vector<TrialJob> shard_jobs;
+        for (auto &job : jobs)
+        {
+            uint cell = job.condition_ind * fill_ratios.size() + job.fill_ind;
+            if (cell % num_shards == shard_ind)
+                shard_jobs.push_back(job);
+        }
+        jobs = shard_jobs;
+    }
+
+    std::string fill_ratio_str(uint fill_ind) const
+    {
+        std::ostringstream ss;
+        ss << std::fixed << std::setprecision(2) << fill_ratios[fill_ind];
+        return ss.str();
+    }
+
+    std::string log_filename(const std::string &log_dir, const TrialJob &job) const
+    {
+        return log_dir + conditions[job.condition_ind].label + '-' +
+               fill_ratio_str(job.fill_ind) + ".h5";
+    }
+
+    void write_manifest(std::ostream &out) const
+    {
+        // One line per job: condition, fill ratio, trial
+        for (auto &job : jobs)
+        {
+            out << conditions[job.condition_ind].label << '\t'
+                << fill_ratio_str(job.fill_ind) << '\t'
+                << job.trial << '\n';
+        }
+    }
+
+private:
+    static void config_error(const std::string &msg)
+    {
+        std::cout << "ERROR: " << msg << std::endl;
+        exit(1);
+    }
+};
+
+} // namespace Kilosim
+
+#endif // SWEEP_PLAN_HPP
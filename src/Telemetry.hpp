@@ -0,0 +1,271 @@
+/*
+ * Live progress of a sweep, written to a status file
+ *
+ * Each running trial (one per ensemble member) has a slot of counters that
+ * only its own thread writes, with relaxed atomic stores, so updating them
+ * costs about as much as a plain store. A background thread reads every slot
+ * periodically and rewrites a JSON status file. The file holds overall
+ * progress, throughput and ETA, each running trial's progress and speed, and
+ * the mean wall time of finished trials of each condition.
+ */
+
+#ifndef TELEMETRY_HPP
+#define TELEMETRY_HPP
+
+#include "SweepPlan.hpp"
+
+#include <stdio.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Kilosim
+{
+
+class SweepTelemetry
+{
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    typedef struct WorkerSlot
+    {
+        // The trial a worker is running (condition -1 if idle)
+        std::atomic<int32_t> condition_ind;
+        std::atomic<uint32_t> fill_ind;
+        std::atomic<uint32_t> trial;
+        std::atomic<uint32_t> tick;
+        std::atomic<uint32_t> tick_rate;
+        // Every tick this worker has simulated
+        std::atomic<uint64_t> ticks_simulated;
+        // Keep slots on separate cache lines so workers don't contend
+        char padding[64];
+    } WorkerSlot;
+
+    const SweepPlan &m_plan;
+    const double m_trial_duration; // seconds
+    const Clock::time_point m_start_time = Clock::now();
+    std::unique_ptr<WorkerSlot[]> m_slots;
+    const uint m_num_slots;
+    // Per condition: finished trials and their total wall time
+    std::unique_ptr<std::atomic<uint32_t>[]> m_condition_trials;
+    std::unique_ptr<std::atomic<uint64_t>[]> m_condition_wall_ms;
+    std::atomic<uint32_t> m_trials_total;
+    std::atomic<uint32_t> m_trials_completed;
+    std::atomic<uint32_t> m_trials_skipped;
+
+    // Status file writer
+    std::thread m_thread;
+    std::mutex m_stop_mutex;
+    std::condition_variable m_stop_cv;
+    bool m_stop = false;
+    // Last sample of each slot's ticks, for speed over the last period
+    std::vector<uint64_t> m_last_ticks;
+    Clock::time_point m_last_write = m_start_time;
+
+    static double seconds_between(Clock::time_point start, Clock::time_point end)
+    {
+        return std::chrono::duration<double>(end - start).count();
+    }
+
+public:
+    SweepTelemetry(const SweepPlan &plan, uint num_workers, uint num_trials,
+                   double trial_duration)
+        : m_plan(plan),
+          m_trial_duration(trial_duration),
+          m_slots(new WorkerSlot[num_workers]),
+          m_num_slots(num_workers),
+          m_condition_trials(new std::atomic<uint32_t>[plan.conditions.size()]),
+          m_condition_wall_ms(new std::atomic<uint64_t>[plan.conditions.size()]),
+          m_trials_total(num_trials),
+          m_trials_completed(0),
+          m_trials_skipped(0),
+          m_last_ticks(num_workers, 0)
+    {
+        for (uint s = 0; s < m_num_slots; s++)
+        {
+            m_slots[s].condition_ind = -1;
+            m_slots[s].fill_ind = 0;
+            m_slots[s].trial = 0;
+            m_slots[s].tick = 0;
+            m_slots[s].tick_rate = 1;
+            m_slots[s].ticks_simulated = 0;
+        }
+        for (uint c = 0; c < plan.conditions.size(); c++)
+        {
+            m_condition_trials[c] = 0;
+            m_condition_wall_ms[c] = 0;
+        }
+    }
+
+    ~SweepTelemetry()
+    {
+        stop();
+    }
+
+    // WORKER UPDATES
+
+    void start_trial(uint slot, const TrialJob &job, uint32_t tick, uint32_t tick_rate)
+    {
+        WorkerSlot &s = m_slots[slot];
+        s.fill_ind.store(job.fill_ind, std::memory_order_relaxed);
+        s.trial.store(job.trial, std::memory_order_relaxed);
+        s.tick.store(tick, std::memory_order_relaxed);
+        s.tick_rate.store(tick_rate, std::memory_order_relaxed);
+        s.condition_ind.store(job.condition_ind, std::memory_order_release);
+    }
+
+    void step(uint slot, uint32_t tick)
+    {
+        // Called after every tick (only by the slot's own worker, so no
+        // read-modify-write is needed)
+        WorkerSlot &s = m_slots[slot];
+        s.tick.store(tick, std::memory_order_relaxed);
+        s.ticks_simulated.store(s.ticks_simulated.load(std::memory_order_relaxed) + 1,
+                                std::memory_order_relaxed);
+    }
+
+    void finish_trial(uint slot, double wall_seconds)
+    {
+        WorkerSlot &s = m_slots[slot];
+        int32_t condition_ind = s.condition_ind.load(std::memory_order_relaxed);
+        s.condition_ind.store(-1, std::memory_order_release);
+        if (condition_ind >= 0)
+        {
+            m_condition_trials[condition_ind]++;
+            m_condition_wall_ms[condition_ind] += (uint64_t)(wall_seconds * 1000);
+        }
+        m_trials_completed++;
+    }
+
+    void skip_trial()
+    {
+        // A planned trial that won't run (adaptive sampling converged)
+        m_trials_skipped++;
+    }
+
+    // STATUS FILE
+
+    void start(const std::string filename, double period)
+    {
+        // Rewrite the status file every period seconds (wall clock) until
+        // stop() is called
+        m_thread = std::thread([this, filename, period]() {
+            std::unique_lock<std::mutex> lock(m_stop_mutex);
+            while (!m_stop)
+            {
+                m_stop_cv.wait_for(lock, std::chrono::duration<double>(period));
+                write(filename);
+            }
+        });
+    }
+
+    void stop()
+    {
+        // Write the status one last time and stop the writer
+        if (!m_thread.joinable())
+            return;
+        {
+            std::lock_guard<std::mutex> lock(m_stop_mutex);
+            m_stop = true;
+        }
+        m_stop_cv.notify_one();
+        m_thread.join();
+    }
+
+    nlohmann::json status()
+    {
+        // Snapshot of every counter (only call from one thread at a time)
+        Clock::time_point now = Clock::now();
+        double elapsed = seconds_between(m_start_time, now);
+        double interval = seconds_between(m_last_write, now);
+        m_last_write = now;
+
+        nlohmann::json report;
+        nlohmann::json workers = nlohmann::json::array();
+        uint num_running = 0;
+        double ticks_per_sec = 0;
+        double simulated_seconds = 0;
+        double trials_in_progress = 0; // Fractions of the running trials done
+        for (uint s = 0; s < m_num_slots; s++)
+        {
+            const WorkerSlot &slot = m_slots[s];
+            uint64_t ticks = slot.ticks_simulated.load(std::memory_order_relaxed);
+            double slot_ticks_per_sec = interval > 0 ? (ticks - m_last_ticks[s]) / interval : 0;
+            m_last_ticks[s] = ticks;
+            ticks_per_sec += slot_ticks_per_sec;
+            double tick_rate = slot.tick_rate.load(std::memory_order_relaxed);
+            simulated_seconds += ticks / tick_rate;
+
+            int32_t condition_ind = slot.condition_ind.load(std::memory_order_acquire);
+            if (condition_ind < 0)
+                continue;
+            num_running++;
+            double time = slot.tick.load(std::memory_order_relaxed) / tick_rate;
+            double progress = std::min(1.0, time / m_trial_duration);
+            trials_in_progress += progress;
+            nlohmann::json worker;
+            worker["worker"] = s;
+            worker["condition"] = m_plan.conditions[condition_ind].label;
+            worker["fill_ratio"] = m_plan.fill_ratio_str(slot.fill_ind.load(std::memory_order_relaxed));
+            worker["trial"] = slot.trial.load(std::memory_order_relaxed);
+            worker["simulated_seconds"] = time;
+            worker["progress"] = progress;
+            worker["ticks_per_second"] = slot_ticks_per_sec;
+            workers.push_back(worker);
+        }
+
+        uint32_t completed = m_trials_completed;
+        uint32_t remaining = m_trials_total - completed - m_trials_skipped;
+        report["elapsed_seconds"] = elapsed;
+        report["trials_total"] = (uint32_t)m_trials_total;
+        report["trials_completed"] = completed;
+        report["trials_skipped"] = (uint32_t)m_trials_skipped;
+        report["trials_running"] = num_running;
+        report["simulated_seconds"] = simulated_seconds;
+        report["ticks_per_second"] = ticks_per_sec;
+        // Time left at the average rate so far (including partial trials)
+        double trials_done = completed + trials_in_progress;
+        if (trials_done > 0)
+            report["eta_seconds"] = elapsed / trials_done * (remaining - trials_in_progress);
+        else
+            report["eta_seconds"] = nullptr;
+        report["workers"] = workers;
+
+        nlohmann::json conditions = nlohmann::json::array();
+        for (uint c = 0; c < m_plan.conditions.size(); c++)
+        {
+            uint32_t trials = m_condition_trials[c];
+            if (trials == 0)
+                continue;
+            nlohmann::json condition;
+            condition["condition"] = m_plan.conditions[c].label;
+            condition["trials_completed"] = trials;
+            condition["mean_trial_seconds"] = m_condition_wall_ms[c] / 1000.0 / trials;
+            conditions.push_back(condition);
+        }
+        report["conditions"] = conditions;
+        return report;
+    }
+
+    void write(const std::string &filename)
+    {
+        // Write to a temporary file first, so readers never see half of one
+        std::string tmp_filename = filename + ".tmp";
+        {
+            std::ofstream out(tmp_filename, std::ios::trunc);
+            out << status().dump(2) << std::endl;
+        }
+        rename(tmp_filename.c_str(), filename.c_str());
+    }
+};
+
+} // namespace Kilosim
+
+#endif // TELEMETRY_HPP
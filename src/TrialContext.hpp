@@ -0,0 +1,171 @@
+/*
+ * Reusable simulation state for running many trials of one condition
+ *
+ * Building a World, Viewer and robots from scratch dominates the cost of short
+ * trials, so a TrialContext builds them once and resets them in place between
+ * trials (clock, light pattern, robot controllers and poses).
+ */
+
+#ifndef TRIAL_CONTEXT_HPP
+#define TRIAL_CONTEXT_HPP
+
+#include "BayesBot.cpp"
+#include "Placement.hpp"
+
+#include <math.h>
+#include <stdlib.h>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include <kilosim/World.h>
+#include <kilosim/Viewer.h>
+
+namespace Kilosim
+{
+
+class TrialWorld : public World
+{
+    // World with a clock that can be rewound for the next trial
+public:
+    TrialWorld(double width, double height, std::string light_img_src)
+        : World(width, height, light_img_src) {}
+
+    void reset_time()
+    {
+        m_tick = 0;
+    }
+
+    void set_tick(uint32_t tick)
+    {
+        // Jump the clock (used when restoring a snapshot)
+        m_tick = tick;
+    }
+};
+
+class TrialContext
+{
+private:
+    // Declared first so robots outlive the World that points to them
+    std::vector<std::unique_ptr<BayesBot>> m_robot_store;
+    NeighborTablePool m_neighbor_tables;
+    BayesBotParams m_params;
+    bool m_tapped;
+    // Starting (x, y) of each robot, shared by every trial
+    std::vector<std::pair<double, double>> m_positions;
+    std::string m_light_img_src;
+    double m_world_width;
+    double m_world_height;
+
+public:
+    TrialWorld world;
+    Viewer viewer;
+    std::vector<BayesBot *> robots;
+
+    TrialContext(double world_width, double world_height,
+                 std::string light_img_src,
+                 std::vector<std::pair<double, double>> positions,
+                 BayesBotParams params,
+                 bool specialize = true,
+                 bool tapped = false)
+        : m_neighbor_tables(positions.size(),
+                            NeighborTablePool::size_for_swarm(positions.size())),
+          m_params(params),
+          m_tapped(tapped || !specialize),
+          m_positions(positions),
+          m_light_img_src(light_img_src),
+          m_world_width(world_width),
+          m_world_height(world_height),
+          world(world_width, world_height, light_img_src),
+          viewer(world),
+          robots(positions.size())
+    {
+        // Robots are allocated and added to the World only once
+        check_positions(m_positions);
+        for (uint n = 0; n < robots.size(); n++)
+        {
+            // Specialized for the condition's policy flags unless disabled
+            m_robot_store.emplace_back(new_bayes_bot(m_params, specialize, tapped));
+            robots[n] = m_robot_store[n].get();
+            robots[n]->params = &m_params;
+            robots[n]->attach_neighbor_table(m_neighbor_tables.table(n),
+                                             m_neighbor_tables.table_size());
+            world.add_robot(robots[n]);
+            robots[n]->robot_init(m_positions[n].first, m_positions[n].second, 0);
+        }
+    }
+
+    void check_positions(const std::vector<std::pair<double, double>> &positions) const
+    {
+        // Bounds and overlap check (in O(n), unlike World::check_validity)
+        std::string error = placement_error(positions, m_world_width, m_world_height);
+        if (!error.empty())
+        {
+            std::cout << "ERROR: Invalid robot placement: " << error << std::endl;
+            exit(1);
+        }
+    }
+
+    void set_positions(const std::vector<std::pair<double, double>> &positions)
+    {
+        // Use new starting positions from the next begin_trial on (otherwise
+        // every trial starts from the same positions, with new headings)
+        check_positions(positions);
+        m_positions = positions;
+    }
+
+    const BayesBotParams &params() const
+    {
+        return m_params;
+    }
+
+    bool is_tapped() const
+    {
+        // Whether the robots can have a BayesBotTap attached (the generic
+        // controller always can)
+        return m_tapped;
+    }
+
+    size_t bytes_per_robot() const
+    {
+        // Controller object plus its share of the pooled neighbor tables
+        return sizeof(BayesBot) + m_neighbor_tables.bytes_per_table();
+    }
+
+    void begin_trial(std::string light_img_src)
+    {
+        // Reset everything in place to start a new trial
+
+        // Only reload the light image if it changed since the last trial
+        if (light_img_src != m_light_img_src)
+        {
+            world.set_light_pattern(light_img_src);
+            m_light_img_src = light_img_src;
+        }
+        world.reset_time();
+
+        // Headings and controller seeds are drawn from the trial's seed
+        for (uint n = 0; n < robots.size(); n++)
+        {
+            robots[n]->reset();
+            robots[n]->robot_init(m_positions[n].first, m_positions[n].second,
+                                  uniform_rand_real(0, 2 * PI));
+            robots[n]->seed_controller(uniform_rand_real(1, 4294967295.0));
+        }
+    }
+
+    void seed_controllers()
+    {
+        // Draw new controller seeds from the current (trial's) seed, e.g. so
+        // trials forked from one snapshot don't all replay its random state
+        for (auto &robot : robots)
+        {
+            robot->seed_controller(uniform_rand_real(1, 4294967295.0));
+        }
+    }
+};
+
+} // namespace Kilosim
+
+#endif // TRIAL_CONTEXT_HPP
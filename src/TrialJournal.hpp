@@ -0,0 +1,151 @@
+/*
+ * Record of completed trials, used to resume an interrupted sweep
+ *
+ * Each finished trial is appended as one line (condition, fill ratio, trial,
+ * then its accuracy, decision time, and 1 if every robot decided or 0 if the
+ * decision time is censored) once its log file has been closed, so
+ * a restarted sweep can skip it and still count its result. A
+ * trial group that exists in an HDF5 file but isn't in the journal was cut
+ * off part way through, and is removed before the trial is re-run.
+ */
+
+#ifndef TRIAL_JOURNAL_HPP
+#define TRIAL_JOURNAL_HPP
+
+#include "TrialStats.hpp"
+
+#include <hdf5.h>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+
+namespace Kilosim
+{
+
+class TrialJournal
+{
+private:
+    std::string m_filename;
+    // Result of each completed trial, by job_key (NAN if not recorded)
+    std::map<std::string, TrialResult> m_completed;
+    std::ofstream m_out;
+
+    static std::string job_key(const std::string &condition_label,
+                               const std::string &fill_ratio_str, uint trial)
+    {
+        std::ostringstream key;
+        key << condition_label << '\t' << fill_ratio_str << '\t' << trial;
+        return key.str();
+    }
+
+public:
+    TrialJournal(const std::string filename) : m_filename(filename)
+    {
+        // Load anything completed by previous runs, then append to it
+        std::ifstream in(filename);
+        std::string line;
+        while (std::getline(in, line))
+        {
+            // The key is the first three tab-separated fields
+            std::istringstream fields(line);
+            std::string label, fill_ratio_str;
+            uint trial;
+            // (Lines from before censoring was recorded count as decided)
+            TrialResult result = {NAN, NAN, true};
+            int decided = 1;
+            if (!std::getline(fields, label, '\t') ||
+                !std::getline(fields, fill_ratio_str, '\t') ||
+                !(fields >> trial))
+                continue;
+            fields >> result.accuracy >> result.decision_time >> decided;
+            result.decided = decided != 0;
+            m_completed[job_key(label, fill_ratio_str, trial)] = result;
+        }
+        m_out.open(filename, std::ios::app);
+    }
+
+    size_t num_completed() const
+    {
+        return m_completed.size();
+    }
+
+    bool is_complete(const std::string &condition_label,
+                     const std::string &fill_ratio_str, uint trial,
+                     TrialResult *result = NULL) const
+    {
+        // Optionally also gets the recorded result of a completed trial
+        auto it = m_completed.find(job_key(condition_label, fill_ratio_str, trial));
+        if (it == m_completed.end())
+            return false;
+        if (result != NULL)
+            *result = it->second;
+        return true;
+    }
+
+    void mark_complete(const std::string &condition_label,
+                       const std::string &fill_ratio_str, uint trial,
+                       const TrialResult &result)
+    {
+        std::string key = job_key(condition_label, fill_ratio_str, trial);
+        m_completed[key] = result;
+        // Flush immediately so the record survives the process being killed
+        m_out << key << '\t' << result.accuracy << '\t' << result.decision_time << '\t'
+              << (result.decided ? 1 : 0) << std::endl;
+    }
+
+    static bool remove_partial_trial(const std::string &log_filename, uint trial)
+    {
+        // Delete the trial's group from the log file if it exists
+        // Returns true if a partial trial was found and removed
+        return edit_trial_group(log_filename, trial, "");
+    }
+
+    static bool keep_partial_trial(const std::string &log_filename, uint trial,
+                                   const std::string &new_name)
+    {
+        // Move the trial's group aside (instead of deleting it) so the rows
+        // logged before a restored snapshot aren't lost
+        return edit_trial_group(log_filename, trial, new_name);
+    }
+
+private:
+    static bool edit_trial_group(const std::string &log_filename, uint trial,
+                                 const std::string &new_name)
+    {
+        // Delete (no new_name) or rename the trial's group, if it exists
+        std::ifstream exists(log_filename);
+        if (!exists.good())
+            return false;
+        exists.close();
+
+        // Quietly handle files that aren't valid HDF5 (or are still locked)
+        H5E_auto2_t old_func;
+        void *old_client_data;
+        H5Eget_auto2(H5E_DEFAULT, &old_func, &old_client_data);
+        H5Eset_auto2(H5E_DEFAULT, NULL, NULL);
+
+        bool changed = false;
+        hid_t file = H5Fopen(log_filename.c_str(), H5F_ACC_RDWR, H5P_DEFAULT);
+        if (file >= 0)
+        {
+            std::string group_name = "trial_" + std::to_string(trial);
+            if (H5Lexists(file, group_name.c_str(), H5P_DEFAULT) > 0)
+            {
+                if (new_name.empty())
+                    changed = H5Ldelete(file, group_name.c_str(), H5P_DEFAULT) >= 0;
+                else
+                    changed = H5Lmove(file, group_name.c_str(), file, new_name.c_str(),
+                                      H5P_DEFAULT, H5P_DEFAULT) >= 0;
+            }
+            H5Fclose(file);
+        }
+
+        H5Eset_auto2(H5E_DEFAULT, old_func, old_client_data);
+        return changed;
+    }
+};
+
+} // namespace Kilosim
+
+#endif // TRIAL_JOURNAL_HPP
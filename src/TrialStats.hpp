@@ -0,0 +1,309 @@
+/*
+ * Running statistics of trial outcomes, for adaptive (sequential) sampling
+ *
+ * Each (condition, fill ratio) cell keeps the running mean and confidence
+ * interval of decision accuracy and time to decision. In adaptive mode a cell
+ * stops getting new trials once its confidence intervals are narrow enough
+ * (or it reaches max_trials), so easy conditions don't use as many trials as
+ * hard ones. Trials in which some robot never decided are censored: they
+ * count towards accuracy, but not towards decision time (they're counted
+ * separately instead). Trials are still seeded by trial number, so any finished trial
+ * can be re-run on its own.
+ */
+
+#ifndef TRIAL_STATS_HPP
+#define TRIAL_STATS_HPP
+
+#include <math.h>
+#include <algorithm>
+#include <iomanip>
+#include <map>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace Kilosim
+{
+
+typedef struct TrialResult
+{
+    // Fraction of robots that chose the majority color
+    double accuracy;
+    // Simulated seconds until every robot decided (or until the trial ended,
+    // if it was censored)
+    double decision_time;
+    // Whether every robot decided (false = decision_time is censored)
+    bool decided;
+} TrialResult;
+
+class RunningStats
+{
+    // Mean and variance in one pass (Welford's algorithm)
+private:
+    uint m_count = 0;
+    double m_mean = 0;
+    double m_m2 = 0;
+
+public:
+    void add(double val)
+    {
+        m_count++;
+        double delta = val - m_mean;
+        m_mean += delta / m_count;
+        m_m2 += delta * (val - m_mean);
+    }
+
+    uint count() const
+    {
+        return m_count;
+    }
+
+    double mean() const
+    {
+        return m_mean;
+    }
+
+    double std_error() const
+    {
+        // Standard error of the mean
+        if (m_count < 2)
+            return INFINITY;
+        return sqrt(m_m2 / (m_count - 1) / m_count);
+    }
+
+    double ci_width(double z) const
+    {
+        // Full width of the normal-approximation confidence interval
+        return 2 * z * std_error();
+    }
+};
+
+typedef struct CellStats
+{
+    RunningStats accuracy;
+    // Of the trials in which every robot decided
+    RunningStats decision_time;
+    uint undecided_trials = 0;
+    // Every trial's values, to compare whole distributions
+    std::vector<double> accuracies;
+    std::vector<double> decision_times;
+} CellStats;
+
+class TrialStats
+{
+private:
+    // Keyed by (condition index, fill ratio index)
+    std::map<std::pair<uint, uint>, CellStats> m_cells;
+
+public:
+    // Target confidence interval widths (0 = fixed trial count)
+    double accuracy_ci_width = 0;
+    double decision_time_ci_width = 0; // seconds (0 = don't check)
+    uint min_trials = 3;
+    double z = 1.96; // 95% confidence
+
+    bool is_adaptive() const
+    {
+        return accuracy_ci_width > 0;
+    }
+
+    void add(uint condition_ind, uint fill_ind, const TrialResult &result)
+    {
+        CellStats &cell = m_cells[std::make_pair(condition_ind, fill_ind)];
+        cell.accuracy.add(result.accuracy);
+        cell.accuracies.push_back(result.accuracy);
+        if (result.decided)
+        {
+            cell.decision_time.add(result.decision_time);
+            cell.decision_times.push_back(result.decision_time);
+        }
+        else
+        {
+            cell.undecided_trials++;
+        }
+    }
+
+    bool is_converged(uint condition_ind, uint fill_ind) const
+    {
+        // Whether a cell has enough trials (only ever true in adaptive mode).
+        // The decision time interval only uses trials that decided.
+        if (!is_adaptive())
+            return false;
+        auto it = m_cells.find(std::make_pair(condition_ind, fill_ind));
+        if (it == m_cells.end() || it->second.accuracy.count() < min_trials)
+            return false;
+        const CellStats &cell = it->second;
+        return cell.accuracy.ci_width(z) <= accuracy_ci_width &&
+               (decision_time_ci_width <= 0 ||
+                cell.decision_time.ci_width(z) <= decision_time_ci_width);
+    }
+
+    template <typename Plan>
+    void write_summary(std::ostream &out, const Plan &plan) const
+    {
+        // One line per cell with the number of trials and mean +/- CI width
+        // (decision time only over the trials that decided)
+        out << "condition\tfill_ratio\ttrials\tundecided_trials\taccuracy\taccuracy_ci"
+               "\tdecision_time\tdecision_time_ci\n";
+        for (auto &entry : m_cells)
+        {
+            const CellStats &cell = entry.second;
+            out << plan.conditions[entry.first.first].label << '\t'
+                << plan.fill_ratio_str(entry.first.second) << '\t'
+                << cell.accuracy.count() << '\t'
+                << cell.undecided_trials << '\t'
+                << cell.accuracy.mean() << '\t'
+                << cell.accuracy.ci_width(z) << '\t'
+                << value_or_na(cell.decision_time.mean(), cell.decision_time.count() > 0) << '\t'
+                << value_or_na(cell.decision_time.ci_width(z), cell.decision_time.count() > 1) << '\n';
+        }
+    }
+
+    template <typename Plan, typename Value>
+    void write_comparison(std::ostream &out, const Plan &plan,
+                          const std::string &key, const Value &baseline_val) const
+    {
+        // Compare each condition against the one that only differs in `key`
+        // (where key == baseline_val), e.g. reduced controller rates against
+        // full rate. Gives the difference in means and its z-score (|z| above
+        // `z` is significant at this confidence level), and the two-sample
+        // Kolmogorov-Smirnov statistic and p-value, which also catch changes
+        // in spread or shape that leave the mean alone. Decision time only
+        // uses trials that decided. With fewer than min_trials (or 2) trials
+        // on either side the tests mean nothing, so they're written as NA and
+        // the row as insufficient.
+        const uint enough_trials = std::max(min_trials, 2u);
+        const double alpha = erfc(z / sqrt(2));
+        out << "condition\tbaseline\tfill_ratio\ttrials\tbaseline_trials"
+               "\taccuracy_diff\taccuracy_z\taccuracy_ks\taccuracy_ks_p"
+               "\tdecision_time_diff\tdecision_time_z\tdecision_time_ks\tdecision_time_ks_p"
+               "\tconsistent\n";
+        for (auto &entry : m_cells)
+        {
+            const auto &condition = plan.conditions[entry.first.first];
+            if (condition.params[key] == baseline_val)
+                continue;
+            auto baseline_params = condition.params;
+            baseline_params[key] = baseline_val;
+            for (uint c = 0; c < plan.conditions.size(); c++)
+            {
+                if (plan.conditions[c].params != baseline_params)
+                    continue;
+                auto it = m_cells.find(std::make_pair(c, entry.first.second));
+                if (it == m_cells.end())
+                    break;
+                const CellStats &cell = entry.second;
+                const CellStats &base = it->second;
+                double accuracy_z = diff_z(cell.accuracy, base.accuracy);
+                double time_z = diff_z(cell.decision_time, base.decision_time);
+                double accuracy_ks = ks_statistic(cell.accuracies, base.accuracies);
+                double accuracy_ks_p = ks_p_value(accuracy_ks, cell.accuracies.size(),
+                                                  base.accuracies.size());
+                double time_ks = ks_statistic(cell.decision_times, base.decision_times);
+                double time_ks_p = ks_p_value(time_ks, cell.decision_times.size(),
+                                              base.decision_times.size());
+                bool accuracy_sufficient = cell.accuracy.count() >= enough_trials &&
+                                           base.accuracy.count() >= enough_trials;
+                bool time_sufficient = cell.decision_time.count() >= enough_trials &&
+                                       base.decision_time.count() >= enough_trials;
+                bool consistent = fabs(accuracy_z) <= z && fabs(time_z) <= z &&
+                                  accuracy_ks_p >= alpha && time_ks_p >= alpha;
+                out << condition.label << '\t'
+                    << plan.conditions[c].label << '\t'
+                    << plan.fill_ratio_str(entry.first.second) << '\t'
+                    << cell.accuracy.count() << '\t'
+                    << base.accuracy.count() << '\t'
+                    << cell.accuracy.mean() - base.accuracy.mean() << '\t'
+                    << value_or_na(accuracy_z, accuracy_sufficient) << '\t'
+                    << accuracy_ks << '\t'
+                    << value_or_na(accuracy_ks_p, accuracy_sufficient) << '\t'
+                    << value_or_na(cell.decision_time.mean() - base.decision_time.mean(),
+                                   cell.decision_time.count() > 0 && base.decision_time.count() > 0)
+                    << '\t'
+                    << value_or_na(time_z, time_sufficient) << '\t'
+                    << value_or_na(time_ks, !cell.decision_times.empty() && !base.decision_times.empty())
+                    << '\t'
+                    << value_or_na(time_ks_p, time_sufficient) << '\t'
+                    << (!accuracy_sufficient || !time_sufficient ? "insufficient"
+                                                                 : consistent ? "yes" : "no")
+                    << '\n';
+                break;
+            }
+        }
+    }
+
+private:
+    static std::string value_or_na(double val, bool known)
+    {
+        // A table value, or NA if it's unknown (e.g. too few trials)
+        if (!known || isnan(val))
+            return "NA";
+        std::ostringstream out;
+        out << val;
+        return out.str();
+    }
+
+    static double diff_z(const RunningStats &a, const RunningStats &b)
+    {
+        // z-score of the difference between two means (Welch), NAN if either
+        // has fewer than 2 values
+        if (a.count() < 2 || b.count() < 2)
+            return NAN;
+        double se = sqrt(a.std_error() * a.std_error() + b.std_error() * b.std_error());
+        double diff = a.mean() - b.mean();
+        if (diff == 0)
+            return 0;
+        return diff / se;
+    }
+
+    static double ks_statistic(std::vector<double> a, std::vector<double> b)
+    {
+        // Largest gap between the two samples' empirical CDFs
+        std::sort(a.begin(), a.end());
+        std::sort(b.begin(), b.end());
+        size_t i = 0;
+        size_t j = 0;
+        double d = 0;
+        while (i < a.size() && j < b.size())
+        {
+            // Step past every value equal to the next smallest (ties are
+            // common, e.g. accuracy of 1)
+            double x = std::min(a[i], b[j]);
+            while (i < a.size() && a[i] <= x)
+                i++;
+            while (j < b.size() && b[j] <= x)
+                j++;
+            d = std::max(d, fabs((double)i / a.size() - (double)j / b.size()));
+        }
+        return d;
+    }
+
+    static double ks_p_value(double d, size_t n, size_t m)
+    {
+        // Asymptotic p-value of a two-sample KS statistic (with the small
+        // sample correction from Numerical Recipes)
+        if (n == 0 || m == 0)
+            return NAN;
+        double ne = (double)n * m / (n + m);
+        double lambda = (sqrt(ne) + 0.12 + 0.11 / sqrt(ne)) * d;
+        if (lambda < 0.2)
+            return 1;
+        double p = 0;
+        double sign = 1;
+        for (int k = 1; k <= 100; k++)
+        {
+            double term = sign * 2 * exp(-2 * k * k * lambda * lambda);
+            p += term;
+            if (fabs(term) < 1e-10)
+                break;
+            sign = -sign;
+        }
+        return std::min(1.0, std::max(0.0, p));
+    }
+};
+
+} // namespace Kilosim
+
+#endif // TRIAL_STATS_HPP
@@ -0,0 +1,184 @@
+/*
+ * Summarize a sweep's log files (see SweepAnalysis.hpp)
+ *
+ * Reads every `<condition>-<fill ratio>.h5` in a log directory, one file per
+ * worker process (HDF5 can only make one call at a time within a process),
+ * and writes:
+ * - analysis_accuracy.tsv: mean accuracy and undecided fraction over time
+ * - analysis_summary.tsv: final accuracy and undecided fraction, and the
+ *   times until 50%, 90% and 100% of the robots decided (or the fractions
+ *   given with --decided)
+ *
+ * Usage: kilosim_analyze LOG_DIR [--jobs N] [--decided 0.5,0.9,1]
+ */
+
+#include "SweepAnalysis.hpp"
+
+#include <dirent.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+typedef struct Worker
+{
+    // A child process reading one log file, and what it has sent back
+    pid_t pid;
+    int fd;
+    size_t log_ind;
+    std::vector<char> buf;
+} Worker;
+
+Worker start_worker(std::vector<Kilosim::LogFile> &logs, size_t log_ind)
+{
+    // Read the log file in a child process, which writes its encoded curves
+    // (nothing if the file can't be read) to a pipe and exits
+    int fds[2];
+    if (pipe(fds) != 0)
+    {
+        std::cout << "ERROR: Cannot create a pipe for a worker" << std::endl;
+        exit(1);
+    }
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        std::cout << "ERROR: Cannot start a worker process" << std::endl;
+        exit(1);
+    }
+    if (pid == 0)
+    {
+        close(fds[0]);
+        // (Unreadable files are reported by the parent)
+        H5Eset_auto2(H5E_DEFAULT, NULL, NULL);
+        Kilosim::LogReader reader;
+        if (reader.read(logs[log_ind]))
+        {
+            std::vector<char> buf = Kilosim::encode_trials(logs[log_ind].trials);
+            for (size_t done = 0; done < buf.size();)
+            {
+                ssize_t written = write(fds[1], buf.data() + done, buf.size() - done);
+                if (written <= 0)
+                    _exit(1);
+                done += written;
+            }
+        }
+        close(fds[1]);
+        _exit(0);
+    }
+    close(fds[1]);
+    return {pid, fds[0], log_ind, {}};
+}
+
+int main(int argc, char *argv[])
+{
+    std::vector<std::string> args(argv, argv + argc);
+    if (args.size() < 2)
+    {
+        std::cout << "ERROR: You must provide a log directory" << std::endl;
+        std::cout << "Usage: kilosim_analyze LOG_DIR [--jobs N] [--decided 0.5,0.9,1]" << std::endl;
+        exit(1);
+    }
+    std::string log_dir = args[1];
+    if (log_dir.back() != '/')
+        log_dir += '/';
+    uint num_jobs = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<double> decided_fractions = {0.5, 0.9, 1};
+    for (uint i = 2; i < args.size(); i++)
+    {
+        if (args[i] == "--jobs" && i + 1 < args.size())
+        {
+            num_jobs = std::max(1, std::stoi(args[++i]));
+        }
+        else if (args[i] == "--decided" && i + 1 < args.size())
+        {
+            decided_fractions.clear();
+            std::istringstream fractions(args[++i]);
+            std::string fraction;
+            while (std::getline(fractions, fraction, ','))
+                decided_fractions.push_back(std::stod(fraction));
+        }
+        else
+        {
+            std::cout << "ERROR: Unknown argument " << args[i] << std::endl;
+            exit(1);
+        }
+    }
+
+    // Find the sweep's log files
+    std::vector<Kilosim::LogFile> logs;
+    DIR *dir = opendir(log_dir.c_str());
+    if (dir == NULL)
+    {
+        std::cout << "ERROR: Cannot open log directory " << log_dir << std::endl;
+        exit(1);
+    }
+    while (struct dirent *entry = readdir(dir))
+    {
+        Kilosim::LogFile log;
+        if (Kilosim::parse_log_filename(log_dir + entry->d_name, log))
+            logs.push_back(log);
+    }
+    closedir(dir);
+    std::sort(logs.begin(), logs.end(),
+              [](const Kilosim::LogFile &a, const Kilosim::LogFile &b) {
+                  return a.filename < b.filename;
+              });
+    std::cout << "Reading " << logs.size() << " log files in "
+              << std::min<size_t>(num_jobs, logs.size()) << " processes" << std::endl;
+
+    // Keep num_jobs workers busy, starting the next file as each one finishes
+    size_t next_log = 0;
+    std::vector<Worker> workers;
+    while (next_log < logs.size() || !workers.empty())
+    {
+        while (next_log < logs.size() && workers.size() < num_jobs)
+            workers.push_back(start_worker(logs, next_log++));
+
+        // Collect whatever the workers have sent so far (so none blocks on a
+        // full pipe)
+        std::vector<pollfd> fds;
+        for (auto &worker : workers)
+            fds.push_back({worker.fd, POLLIN, 0});
+        if (poll(fds.data(), fds.size(), -1) < 0)
+            continue;
+        for (size_t w = workers.size(); w-- > 0;)
+        {
+            if (fds[w].revents == 0)
+                continue;
+            Worker &worker = workers[w];
+            char chunk[1 << 16];
+            ssize_t num_read = read(worker.fd, chunk, sizeof(chunk));
+            if (num_read > 0)
+            {
+                worker.buf.insert(worker.buf.end(), chunk, chunk + num_read);
+                continue;
+            }
+            // End of the pipe: the worker is done
+            close(worker.fd);
+            int status;
+            waitpid(worker.pid, &status, 0);
+            Kilosim::LogFile &log = logs[worker.log_ind];
+            if (!WIFEXITED(status) || WEXITSTATUS(status) != 0 || worker.buf.empty() ||
+                !Kilosim::decode_trials(worker.buf, log.trials))
+            {
+                log.trials.clear();
+                std::cout << "Skipping unreadable " << log.filename << std::endl;
+            }
+            workers.erase(workers.begin() + w);
+        }
+    }
+
+    std::ofstream curves_file(log_dir + "analysis_accuracy.tsv");
+    Kilosim::write_accuracy_curves(curves_file, logs);
+    std::ofstream summary_file(log_dir + "analysis_summary.tsv");
+    Kilosim::write_analysis_summary(summary_file, logs, decided_fractions);
+    Kilosim::write_analysis_summary(std::cout, logs, decided_fractions);
+
+    return 0;
+}
@@ -0,0 +1,148 @@
+/*
+ * Benchmarks for the BayesBot controller
+ *
+ * Reports memory per robot and simulation throughput for a range of swarm
+ * sizes (kept at the same density as the 100-robot, 2400x2400 configs), for
+ * the generic BayesBot and for each compile-time specialized variant.
+ *
+ * The step gain is the speedup of the whole World::step (physics included);
+ * the controller gain is the speedup of the controllers alone, replaying a
+ * trace recorded from the specialized swarm (see kilosim_demo_replay).
+ *
+ * Usage: kilosim_demo_bench [num_robots ...]
+ */
+
+#include "BayesBot.cpp"
+#include "ControllerTrace.hpp"
+#include "TrialContext.hpp"
+
+#include <math.h>
+#include <stdio.h>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Simulated seconds to run for each swarm size
+const double bench_duration = 60;
+// Simulated seconds to record for the controller-only replay
+const double bench_trace_duration = 10;
+const std::string bench_trace_file = "kilosim_demo_bench.trace";
+
+double bench_swarm(uint num_robots, Kilosim::BayesBotParams params, bool specialize)
+{
+    // Returns the time per robot per tick (ns)
+    const double world_size = 2400 * sqrt(num_robots / 100.0);
+    Kilosim::Positions positions = Kilosim::Placement("grid", world_size, world_size).place(num_robots);
+
+    seed_rand(1);
+    Kilosim::TrialContext context(world_size, world_size, "", positions, params, specialize);
+    context.begin_trial("");
+
+    auto start = std::chrono::steady_clock::now();
+    while (context.world.get_time() < bench_duration)
+    {
+        context.world.step();
+    }
+    auto end = std::chrono::steady_clock::now();
+    double elapsed = std::chrono::duration<double>(end - start).count();
+    double ticks = context.world.get_tick();
+    double ns_per_robot_tick = elapsed * 1e9 / (ticks * num_robots);
+
+    std::cout << std::setw(10) << num_robots
+              << std::setw(16) << context.bytes_per_robot()
+              << std::setw(16) << std::fixed << std::setprecision(1) << ticks / elapsed
+              << std::setw(20) << std::setprecision(3) << ns_per_robot_tick;
+    return ns_per_robot_tick;
+}
+
+double bench_controller(uint num_robots, Kilosim::BayesBotParams params)
+{
+    // Returns the controller-only gain (generic over specialized time per
+    // loop() call), or 0 if the replay doesn't match the recording
+    const double world_size = 2400 * sqrt(num_robots / 100.0);
+    Kilosim::Positions positions = Kilosim::Placement("grid", world_size, world_size).place(num_robots);
+
+    seed_rand(1);
+    Kilosim::TrialContext context(world_size, world_size, "", positions, params, true, true);
+    context.begin_trial("");
+    {
+        Kilosim::TraceRecorder recorder(context);
+        while (context.world.get_time() < bench_trace_duration)
+        {
+            context.world.step();
+        }
+        if (!recorder.write(bench_trace_file))
+        {
+            std::cout << "ERROR: Unable to write " << bench_trace_file << std::endl;
+            exit(1);
+        }
+    }
+
+    Kilosim::TracePlayer player;
+    bool loaded = player.load(bench_trace_file);
+    remove(bench_trace_file.c_str());
+    if (!loaded)
+        return 0;
+    double elapsed[2];
+    for (int specialize = 0; specialize < 2; specialize++)
+    {
+        if (!player.reset(specialize))
+            return 0;
+        auto start = std::chrono::steady_clock::now();
+        uint64_t num_loops = player.play();
+        auto end = std::chrono::steady_clock::now();
+        if (num_loops == 0 || player.first_mismatch() >= 0)
+            return 0;
+        elapsed[specialize] = std::chrono::duration<double>(end - start).count();
+    }
+    return elapsed[0] / elapsed[1];
+}
+
+int main(int argc, char *argv[])
+{
+    std::vector<uint> swarm_sizes = {100, 1000, 10000};
+    if (argc > 1)
+    {
+        swarm_sizes.clear();
+        for (int i = 1; i < argc; i++)
+        {
+            swarm_sizes.push_back(std::stoul(argv[i]));
+        }
+    }
+
+    std::cout << "sizeof(BayesBot): " << sizeof(Kilosim::BayesBot) << " bytes" << std::endl;
+    // Policy variants: (positive feedback, simultaneity, prior)
+    for (int variant = 0; variant < 8; variant++)
+    {
+        Kilosim::BayesBotParams params;
+        params.use_positive_feedback = (variant & 4) != 0;
+        params.allow_simultaneity = (variant & 2) != 0;
+        params.light_prior = params.dark_prior = (variant & 1) ? 1 : 10;
+        std::cout << std::endl
+                  << "positive_feedback=" << (int)params.use_positive_feedback
+                  << " allow_simultaneity=" << (int)params.allow_simultaneity
+                  << " prior=" << params.light_prior << std::endl;
+        std::cout << std::setw(10) << "robots"
+                  << std::setw(16) << "bytes/robot"
+                  << std::setw(16) << "ticks/sec"
+                  << std::setw(20) << "ns/robot-tick"
+                  << std::setw(12) << "step gain"
+                  << std::setw(18) << "controller gain" << std::endl;
+        for (uint num_robots : swarm_sizes)
+        {
+            double generic_ns = bench_swarm(num_robots, params, false);
+            std::cout << std::setw(10) << "(generic)" << std::endl;
+            double specialized_ns = bench_swarm(num_robots, params, true);
+            std::cout << std::setw(11) << std::setprecision(2) << generic_ns / specialized_ns << "x";
+            double controller_gain = bench_controller(num_robots, params);
+            if (controller_gain > 0)
+                std::cout << std::setw(17) << std::setprecision(2) << controller_gain << "x" << std::endl;
+            else
+                std::cout << std::setw(18) << "(no match)" << std::endl;
+        }
+    }
+
+    return 0;
+}
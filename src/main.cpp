@@ -1,7 +1,17 @@
 #include "BayesBot.cpp"
-#include "ProgressBar.hpp"
+#include "SweepPlan.hpp"
+#include "ControllerTrace.hpp"
+#include "Placement.hpp"
+#include "Snapshot.hpp"
+#include "Telemetry.hpp"
+#include "TrialContext.hpp"
+#include "TrialJournal.hpp"
+#include "TrialStats.hpp"
 
 #include <math.h>
+#include <stdio.h>
+#include <chrono>
+#include <fstream>
 #include <iomanip>
 #include <sstream>
 #include <kilosim/World.h>
@@ -63,6 +73,42 @@ std::vector<double> robot_observation_count(std::vector<Kilosim::Robot *> &robot
     return observation_counts;
 }
 
+std::vector<double> robot_messages_sent(std::vector<Kilosim::Robot *> &robots)
+{
+    // Pull each robot's count of broadcasts
+    std::vector<double> sent(robots.size());
+    for (int i = 0; i < robots.size(); i++)
+    {
+        Kilosim::BayesBot *bb = (Kilosim::BayesBot *)robots[i];
+        sent[i] = bb->messages_sent;
+    }
+    return sent;
+}
+
+std::vector<double> robot_messages_delivered(std::vector<Kilosim::Robot *> &robots)
+{
+    // Pull each robot's count of broadcasts that reached a neighbor
+    std::vector<double> delivered(robots.size());
+    for (int i = 0; i < robots.size(); i++)
+    {
+        Kilosim::BayesBot *bb = (Kilosim::BayesBot *)robots[i];
+        delivered[i] = bb->messages_delivered;
+    }
+    return delivered;
+}
+
+std::vector<double> robot_messages_ignored(std::vector<Kilosim::Robot *> &robots)
+{
+    // Pull each robot's count of received messages that weren't used
+    std::vector<double> ignored(robots.size());
+    for (int i = 0; i < robots.size(); i++)
+    {
+        Kilosim::BayesBot *bb = (Kilosim::BayesBot *)robots[i];
+        ignored[i] = bb->messages_ignored;
+    }
+    return ignored;
+}
+
 bool all_robots_decided(std::vector<Kilosim::BayesBot *> &robots)
 {
     // Add the ability to stop the simulation early if all the robots
@@ -75,224 +121,590 @@ bool all_robots_decided(std::vector<Kilosim::BayesBot *> &robots)
     return true;
 }
 
-// HACKY STUFF
+// CONFIG HELPERS
 
-nlohmann::json get_val(Kilosim::ConfigParser config, std::string key,
-                       std::string compare_param, int compare_ind)
+nlohmann::json get_optional(Kilosim::ConfigParser &config, std::string key,
+                            nlohmann::json default_val)
 {
-    // Hacky approach to getting the indexed value if this is the compare_param,
-    // or otherwise just returning the scalar value
-    if (compare_param == key)
+    // For settings that older config files don't have
+    nlohmann::json val = config.get(key);
+    if (val.is_null())
+        return default_val;
+    return val;
+}
+
+// MAIN STUFF
+
+Kilosim::BayesBotParams condition_bot_params(const Kilosim::SweepCondition &condition)
+{
+    // Set any implementation-specific config that comes from config file
+    // (shared by all robots in a condition)
+    Kilosim::BayesBotParams bot_params;
+    bot_params.credible_thresh = condition.params["credible_thresh"];
+    bot_params.allow_simultaneity = condition.params["allow_simultaneity"];
+    bot_params.use_positive_feedback = condition.params["use_positive_feedback"];
+    bot_params.observe_step_time = condition.params["observe_step_time"]; // seconds
+    bot_params.dark_prior = condition.params["both_prior"];
+    bot_params.light_prior = condition.params["both_prior"];
+    if (!condition.params["controller_period"].is_null())
+    {
+        int controller_period = condition.params["controller_period"];
+        if (controller_period < 1 || controller_period > UINT16_MAX)
+        {
+            std::cout << "ERROR: controller_period must be from 1 to " << UINT16_MAX << std::endl;
+            exit(1);
+        }
+        bot_params.controller_period = controller_period;
+    }
+    if (!condition.params["tx_policy"].is_null())
     {
-        return config.get(key)[compare_ind];
+        std::string tx_policy = condition.params["tx_policy"];
+        if (tx_policy == "always")
+            bot_params.tx_policy = Kilosim::TX_ALWAYS;
+        else if (tx_policy == "periodic")
+            bot_params.tx_policy = Kilosim::TX_PERIODIC;
+        else if (tx_policy == "on_change")
+            bot_params.tx_policy = Kilosim::TX_ON_CHANGE;
+        else if (tx_policy == "duty_cycle")
+            bot_params.tx_policy = Kilosim::TX_DUTY_CYCLE;
+        else
+        {
+            std::cout << "ERROR: Unknown tx_policy \"" << tx_policy
+                      << "\" (must be always, periodic, on_change, or duty_cycle)" << std::endl;
+            exit(1);
+        }
     }
-    else
+    if (!condition.params["tx_period"].is_null())
     {
-        return config.get(key);
+        int tx_period = condition.params["tx_period"];
+        if (tx_period < 1)
+        {
+            std::cout << "ERROR: tx_period must be at least 1" << std::endl;
+            exit(1);
+        }
+        bot_params.tx_period = tx_period;
     }
+    if (!condition.params["tx_keepalive"].is_null())
+    {
+        // Without repeats, robots that come into range after a message was
+        // sent would never hear it
+        int tx_keepalive = condition.params["tx_keepalive"];
+        if (tx_keepalive < 1)
+        {
+            std::cout << "ERROR: tx_keepalive must be at least 1" << std::endl;
+            exit(1);
+        }
+        bot_params.tx_keepalive = tx_keepalive;
+    }
+    if (!condition.params["tx_duty_cycle"].is_null())
+    {
+        double tx_duty_cycle = condition.params["tx_duty_cycle"];
+        if (!(tx_duty_cycle >= 0 && tx_duty_cycle <= 1))
+        {
+            std::cout << "ERROR: tx_duty_cycle must be from 0 to 1" << std::endl;
+            exit(1);
+        }
+        bot_params.tx_duty_cycle = tx_duty_cycle;
+    }
+    return bot_params;
 }
 
-// MAIN STUFF
+// TRIAL RUNNER
 
-int main(int argc, char *argv[])
+typedef struct SweepSettings
+{
+    // Settings shared by every trial in the sweep
+    Kilosim::ConfigParser *config;
+    const Kilosim::SweepPlan *plan;
+    const Kilosim::Placement *placement;
+    Kilosim::TrialJournal *journal;
+    double trial_duration; // seconds
+    std::string light_img_src;
+    std::string log_dir;
+    unsigned long seed_base;
+    uint snapshot_period; // seconds (0 = no snapshots)
+    double trace_duration; // seconds of each trial to record (0 = no traces)
+    std::string fork_snapshot_src;
+    std::vector<char> fork_snapshot;
+    Kilosim::SweepTelemetry *telemetry;
+    bool draw;
+} SweepSettings;
+
+unsigned long interval_seed(unsigned long seed_base, uint trial, uint32_t tick)
+{
+    // Seed for the stretch of a trial's steps starting at tick (mixed with
+    // the splitmix64 finalizer so nearby trials and ticks are unrelated)
+    uint64_t x = (uint64_t)(seed_base + trial) * 0x9e3779b97f4a7c15ULL + tick;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return (unsigned long)(x ^ (x >> 31));
+}
+
+class TrialRun
 {
-    // To avoid showing a bunch of slow/unnecessary progress bars on AWS
-    bool show_progress = false;
+    // One trial of a job, advanced in chunks so that several trials can run
+    // side by side (see the ensemble loop in main). All calls are made from
+    // one thread.
+private:
+    const SweepSettings &m_settings;
+    Kilosim::TrialContext &m_context;
+    const Kilosim::SweepCondition &m_condition;
+    const uint32_t m_log_ticks;
+    const uint32_t m_snapshot_ticks;
+    // Telemetry slot this trial reports its progress in
+    const uint m_worker;
+    std::chrono::steady_clock::time_point m_wall_start;
+    std::string m_fill_ratio_str;
+    std::string m_log_filename;
+    std::string m_snapshot_filename;
+    std::string m_trace_filename;
+    std::unique_ptr<Kilosim::Logger> m_logger;
+    std::unique_ptr<Kilosim::TraceRecorder> m_trace_recorder;
+    Kilosim::SnapshotWriter m_snapshot_writer;
+
+    bool is_sync_tick(uint32_t tick) const
+    {
+        return tick % m_log_ticks == 0 ||
+               (m_snapshot_ticks > 0 && tick % m_snapshot_ticks == 0);
+    }
+
+public:
+    const Kilosim::TrialJob job;
+    bool is_done = false;
+
+    TrialRun(const SweepSettings &settings, Kilosim::TrialContext &context,
+             const Kilosim::TrialJob &job, uint worker)
+        : m_settings(settings),
+          m_context(context),
+          m_condition(settings.plan->conditions[job.condition_ind]),
+          m_log_ticks((uint)m_condition.params["log_freq"] * context.world.get_tick_rate()),
+          m_snapshot_ticks(settings.snapshot_period * context.world.get_tick_rate()),
+          m_worker(worker),
+          m_fill_ratio_str(settings.plan->fill_ratio_str(job.fill_ind)),
+          m_log_filename(settings.plan->log_filename(settings.log_dir, job)),
+          m_snapshot_filename(m_log_filename.substr(0, m_log_filename.size() - 3) +
+                              "-trial_" + std::to_string(job.trial) + ".snap"),
+          m_trace_filename(m_log_filename.substr(0, m_log_filename.size() - 3) +
+                           "-trial_" + std::to_string(job.trial) + ".trace"),
+          job(job) {}
+
+    void start()
+    {
+        const uint trial = job.trial;
+        double fill_ratio = m_settings.plan->fill_ratios[job.fill_ind];
+
+        // Continue from this trial's last snapshot if it was interrupted
+        // (keeping what it logged so far), otherwise start from scratch
+        std::vector<char> snapshot;
+        if (!m_settings.fork_snapshot.empty())
+        {
+            snapshot = m_settings.fork_snapshot;
+        }
+        else if (m_snapshot_ticks > 0 && Kilosim::read_snapshot(m_snapshot_filename, snapshot))
+        {
+            std::string kept_name = "trial_" + std::to_string(trial) + "_until_tick_" +
+                                    std::to_string(Kilosim::snapshot_tick(snapshot));
+            Kilosim::TrialJournal::keep_partial_trial(m_log_filename, trial, kept_name);
+            std::cout << "Resuming trial " << trial << " of " << m_log_filename
+                      << " from snapshot (earlier rows in " << kept_name << ")" << std::endl;
+        }
+        else if (Kilosim::TrialJournal::remove_partial_trial(m_log_filename, trial))
+        {
+            std::cout << "Removed partial trial " << trial << " from " << m_log_filename << std::endl;
+        }
+
+        // Configure light image filename
+        std::string light_img_filename = m_settings.light_img_src + "rect-" + m_fill_ratio_str + "-" + std::to_string(trial) + ".png";
+
+        // Each trial gets its own seed so any single job can be re-run alone
+        // (random placements are cached, so they're drawn before seeding)
+        if (m_settings.placement->is_random())
+            m_context.set_positions(m_settings.placement->place_trial(m_context.robots.size(),
+                                                                      m_settings.seed_base + trial));
+        seed_rand(m_settings.seed_base + trial);
+        m_context.begin_trial(light_img_filename);
+        if (!snapshot.empty() && !Kilosim::restore_snapshot(m_context, snapshot))
+        {
+            if (!m_settings.fork_snapshot.empty())
+            {
+                std::cout << "ERROR: Snapshot " << m_settings.fork_snapshot_src
+                          << " does not match condition " << m_condition.label << std::endl;
+                exit(1);
+            }
+            // Stale snapshot (e.g. the config changed), so start over
+            std::cout << "Ignoring mismatched snapshot " << m_snapshot_filename << std::endl;
+            snapshot.clear();
+            seed_rand(m_settings.seed_base + trial);
+            m_context.begin_trial(light_img_filename);
+        }
+        else if (!snapshot.empty() && !m_settings.fork_snapshot.empty())
+        {
+            // Forked trials share the snapshot's poses and beliefs, but each
+            // gets its own controller randomness (from the trial's seed) so
+            // they're replicates rather than copies
+            m_context.seed_controllers();
+        }
 
-    // Get config file name
+        // Set up logging
+        // (Any earlier copy of this trial is incomplete, so it's overwritten)
+        m_logger.reset(new Kilosim::Logger(
+            m_context.world,
+            m_log_filename,
+            trial,
+            true));
+        m_logger->add_aggregator("light_count", robot_light_count);
+        m_logger->add_aggregator("dark_count", robot_dark_count);
+        m_logger->add_aggregator("decision", robot_decision);
+        m_logger->add_aggregator("observation_count", robot_observation_count);
+        m_logger->add_aggregator("messages_sent", robot_messages_sent);
+        m_logger->add_aggregator("messages_delivered", robot_messages_delivered);
+        m_logger->add_aggregator("messages_ignored", robot_messages_ignored);
+        m_logger->log_config(*m_settings.config, false);
+        // Log the fill_ratio separately because it's not in the config
+        m_logger->log_param("fill_ratio", fill_ratio);
+        // Add logging of the swept parameters' values for this condition
+        for (uint k = 0; k < m_settings.plan->swept_keys.size(); k++)
+        {
+            m_logger->log_param(m_settings.plan->swept_keys[k], m_condition.swept_vals[k]);
+        }
+        if (!snapshot.empty())
+        {
+            // Rows in this trial's group start here instead of at time 0
+            m_logger->log_param("restored_from_time", m_context.world.get_time());
+        }
+
+        // Record the controllers' inputs for replaying (kilosim_demo_replay)
+        if (m_settings.trace_duration > 0)
+            m_trace_recorder.reset(new Kilosim::TraceRecorder(m_context));
+
+        m_wall_start = std::chrono::steady_clock::now();
+        m_settings.telemetry->start_trial(m_worker, job, m_context.world.get_tick(),
+                                          m_context.world.get_tick_rate());
+    }
+
+    void advance()
+    {
+        // Step the simulation up to the next tick that needs sync() (logging
+        // or a snapshot) or the end of the trial.
+        Kilosim::TrialWorld &world = m_context.world;
+        // Kilosim draws from one process-wide generator, so reseed it from
+        // this trial and tick. A trial's draws then don't depend on which
+        // other trials were stepped in between (or on ensemble_size).
+        seed_rand(interval_seed(m_settings.seed_base, job.trial, world.get_tick()));
+        do
+        {
+            // Run a simulation step
+            // This automatically increments the tick
+            world.step();
+
+            if (m_settings.draw)
+                m_context.viewer.draw();
+
+            m_settings.telemetry->step(m_worker, world.get_tick());
+        } while (!is_sync_tick(world.get_tick()) && world.get_time() < m_settings.trial_duration);
+    }
+
+    void sync()
+    {
+        // Log and snapshot at the tick advance() stopped on, and check
+        // whether the trial is over
+        Kilosim::TrialWorld &world = m_context.world;
+        if ((world.get_tick() % m_log_ticks) == 0)
+        {
+            // Log the state of the world every log_freq seconds
+            // This works because the tickRate (ticks/sec) must be an integer
+            m_logger->log_state();
+
+            // End trial early if all of the robots have decided
+            // And only allow this after the decisions have been logged!
+            if (all_robots_decided(m_context.robots))
+                is_done = true;
+        }
+        if (m_snapshot_ticks > 0 && (world.get_tick() % m_snapshot_ticks) == 0)
+        {
+            // Capture now, write in the background
+            m_snapshot_writer.write(m_snapshot_filename, Kilosim::capture_snapshot(m_context));
+        }
+        if (world.get_time() >= m_settings.trial_duration)
+            is_done = true;
+        if (m_trace_recorder && (is_done || world.get_time() >= m_settings.trace_duration))
+            write_trace();
+    }
+
+    void write_trace()
+    {
+        if (!m_trace_recorder->write(m_trace_filename))
+            std::cout << "Failed to write trace " << m_trace_filename << std::endl;
+        m_trace_recorder.reset();
+    }
+
+    Kilosim::TrialResult finish()
+    {
+        std::vector<Kilosim::BayesBot *> &robots = m_context.robots;
+        double fill_ratio = m_settings.plan->fill_ratios[job.fill_ind];
+        int correct_decision = 0;
+        int undecided_count = 0;
+        for (int i = 0; i < robots.size(); i++)
+        {
+            // The majority color is correct (light if the fill ratio is 0.5)
+            if (robots[i]->decision == -1)
+                undecided_count++;
+            else if (robots[i]->decision == (fill_ratio >= 0.5 ? 1 : 0))
+                correct_decision++;
+        }
+        Kilosim::TrialResult result;
+        result.accuracy = (double)correct_decision / robots.size();
+        // A trial that ran out of time before every robot decided only gives
+        // a lower bound on the decision time
+        result.decision_time = m_context.world.get_time();
+        result.decided = undecided_count == 0;
+
+        // Close the log file before recording the trial as complete
+        m_logger.reset();
+        m_settings.journal->mark_complete(m_condition.label, m_fill_ratio_str, job.trial, result);
+        if (m_snapshot_ticks > 0)
+        {
+            // A finished trial never needs to be resumed
+            m_snapshot_writer.wait();
+            remove(m_snapshot_filename.c_str());
+        }
+
+        m_settings.telemetry->finish_trial(
+            m_worker, std::chrono::duration<double>(std::chrono::steady_clock::now() - m_wall_start).count());
+
+        // Print out statistics when trial is finished.
+        int time = m_context.world.get_time();
+        std::cout << "Trial " << job.trial << "    [" << m_fill_ratio_str << "]    " << m_condition.label << std::endl;
+        std::cout << "Simulated duration:\t"
+                  << std::setfill('0') << std::setw(2) << (int)(time / 3600) << ":"
+                  << std::setfill('0') << std::setw(2) << (int)((time % 3600) / 60) << ":"
+                  << std::setfill('0') << std::setw(2) << time % 60 << std::endl;
+        std::cout << "Decision accuracy:\t" << result.accuracy * 100 << "%" << std::endl;
+        std::cout << "Undecided robots:\t" << undecided_count << "/" << robots.size() << std::endl;
+        return result;
+    }
+};
+
+// MAIN
+
+int main(int argc, char *argv[])
+{
+    // Get config file name and options
     std::vector<std::string> args(argv, argv + argc);
     if (args.size() < 2)
     {
         std::cout << "ERROR: You must provide a config file name" << std::endl;
+        std::cout << "Usage: kilosim_demo CONFIG_FILE [--shard i/N] [--dry-run]" << std::endl;
         exit(1);
     }
+    uint shard_ind = 0;
+    uint num_shards = 1;
+    bool dry_run = false;
+    for (uint i = 2; i < args.size(); i++)
+    {
+        if (args[i] == "--shard" && i + 1 < args.size())
+        {
+            // Run only this machine's share of the jobs
+            if (sscanf(args[++i].c_str(), "%u/%u", &shard_ind, &num_shards) != 2 ||
+                num_shards == 0 || shard_ind >= num_shards)
+            {
+                std::cout << "ERROR: --shard must be i/N with 0 <= i < N" << std::endl;
+                exit(1);
+            }
+        }
+        else if (args[i] == "--dry-run")
+        {
+            // Only print the jobs that would be run
+            dry_run = true;
+        }
+        else
+        {
+            std::cout << "ERROR: Unknown argument " << args[i] << std::endl;
+            exit(1);
+        }
+    }
     Kilosim::ConfigParser config(args[1]);
 
-    // Get configuration values
-    const std::string compare_param = config.get("compare_param");
-    nlohmann::json compare_vals = config.get(compare_param);
-    const uint num_compare_vals = compare_vals.size();
-
-    const uint start_trial = config.get("start_trial");
-    const uint num_trials = config.get("num_trials");
-    const double trial_duration = config.get("trial_duration"); // seconds
-    const std::string light_img_src = config.get("light_img_src");
-    const std::string log_dir = config.get("log_dir");
-    const std::vector<double> fill_ratios = config.get("fill_ratios");
+    // Adaptive sampling: stop giving a condition/fill ratio new trials once
+    // the confidence interval of its accuracy is narrower than this
+    Kilosim::TrialStats stats;
+    stats.accuracy_ci_width = get_optional(config, "adaptive_ci_width", 0);
+    stats.decision_time_ci_width = get_optional(config, "adaptive_time_ci_width", 0);
+    stats.min_trials = get_optional(config, "min_trials", stats.min_trials);
+    const uint max_trials = stats.is_adaptive() ? (uint)get_optional(config, "max_trials", config.get("num_trials")) : 0;
+
+    // Expand the swept parameters into a list of trials (and check the config)
+    Kilosim::SweepPlan plan(config, max_trials);
+    plan.shard(shard_ind, num_shards);
+    if (dry_run)
+    {
+        plan.write_manifest(std::cout);
+        return 0;
+    }
+
+    // Get configuration values that are the same for every condition
+    SweepSettings settings;
+    settings.config = &config;
+    settings.plan = &plan;
+    settings.trial_duration = config.get("trial_duration"); // seconds
+    settings.light_img_src = config.get("light_img_src").get<std::string>();
+    settings.log_dir = config.get("log_dir").get<std::string>();
+    settings.seed_base = config.get("seed_base");
     const double world_width = config.get("world_width");
     const double world_height = config.get("world_height");
-    const unsigned long seed_base = config.get("seed_base");
+    // How robots are laid out at the start of each trial (see Placement.hpp)
+    const Kilosim::Placement placement(get_optional(config, "placement", "grid").get<std::string>(),
+                                       world_width, world_height);
+    settings.placement = &placement;
+    // Simulated seconds between snapshots of a running trial (0 = none)
+    settings.snapshot_period = get_optional(config, "snapshot_period", 0);
+    settings.trace_duration = get_optional(config, "trace_duration", 0);
+    // Snapshot to start every trial from, instead of from the beginning
+    settings.fork_snapshot_src = get_optional(config, "restore_snapshot", "").get<std::string>();
+    if (!settings.fork_snapshot_src.empty() &&
+        !Kilosim::read_snapshot(settings.fork_snapshot_src, settings.fork_snapshot))
+    {
+        std::cout << "ERROR: Could not read snapshot " << settings.fork_snapshot_src << std::endl;
+        exit(1);
+    }
+    // Number of trials of a condition to run side by side
+    const uint ensemble_size = get_optional(config, "ensemble_size", 1);
+    if (ensemble_size == 0)
+    {
+        std::cout << "ERROR: ensemble_size must be at least 1" << std::endl;
+        exit(1);
+    }
+    // Drawing only makes sense one trial at a time (and can be turned off,
+    // e.g. to run without a display)
+    settings.draw = ensemble_size == 1 && (int)get_optional(config, "draw", 1) != 0;
+
+    // Trials finished by earlier (interrupted) runs are skipped
+    Kilosim::TrialJournal journal(settings.log_dir + "completed_trials.tsv");
+    settings.journal = &journal;
+    if (journal.num_completed() > 0)
+    {
+        std::cout << "Resuming: " << journal.num_completed()
+                  << " trials already completed" << std::endl;
+    }
+    std::vector<Kilosim::TrialJob> jobs;
+    for (auto &job : plan.jobs)
+    {
+        Kilosim::TrialResult result;
+        if (!journal.is_complete(plan.conditions[job.condition_ind].label,
+                                 plan.fill_ratio_str(job.fill_ind), job.trial, &result))
+            jobs.push_back(job);
+        else if (!std::isnan(result.accuracy))
+            stats.add(job.condition_ind, job.fill_ind, result);
+    }
 
-    // Constant values used for configuring initial robot positions
-    const double grid_cover = 0.8; // cover 90% of width/height
-    const double x_pos_offset = world_width * (1.0 - grid_cover) / 2;
-    const double y_pos_offset = world_height * (1.0 - grid_cover) / 2;
+    // Progress of every running trial, written to a status file every
+    // status_period seconds (0 = never)
+    Kilosim::SweepTelemetry telemetry(plan, ensemble_size, jobs.size(), settings.trial_duration);
+    settings.telemetry = &telemetry;
+    const double status_period = get_optional(config, "status_period", 10);
+    if (status_period > 0)
+    {
+        telemetry.start(settings.log_dir + "status" +
+                            (num_shards > 1 ? "-shard_" + std::to_string(shard_ind) : "") + ".json",
+                        status_period);
+    }
 
-    // Length of time covered by a single dot in the progress bar
-    const int progress_update_freq = 60;
-    const int limit = trial_duration / progress_update_freq;
+    // Worlds, Viewers, and robots are built once per condition (one set per
+    // ensemble member) and reset in place for every trial
+    std::vector<std::unique_ptr<Kilosim::TrialContext>> contexts;
+    int contexts_condition_ind = -1;
 
-    // Loop through the parameter under investigation (compare_param)
-    for (uint compare_ind = 0; compare_ind < num_compare_vals; compare_ind++)
+    uint next_job = 0;
+    while (next_job < jobs.size())
     {
-
-        // These are things that can possibly be varied between conditions
-        uint use_positive_feedback = get_val(config, "use_positive_feedback", compare_param, compare_ind);
-        uint log_freq = get_val(config, "log_freq", compare_param, compare_ind); // seconds
-        uint num_robots = get_val(config, "num_robots", compare_param, compare_ind);
-        double credible_thresh = get_val(config, "credible_thresh", compare_param, compare_ind);
-        uint allow_simultaneity = get_val(config, "allow_simultaneity", compare_param, compare_ind);
-        uint observe_step_time = get_val(config, "observe_step_time", compare_param, compare_ind); // seconds
-        uint both_prior = get_val(config, "both_prior", compare_param, compare_ind);
-        // uint dark_prior = get_val(config, "dark_prior", compare_param, compare_ind);
-        // uint light_prior = get_val(config, "light_prior", compare_param, compare_ind);
-        json compare_val = config.get(compare_param)[compare_ind];
-
-        // uint log_freq = config.get("log_freq"); // kiloticks
-        // uint num_robots = config.get("num_robots");
-        // double credible_thresh = config.get("credible_thresh");
-        // uint allow_simultaneity = config.get("allow_simultaneity");
-        // uint observe_step_time = config.get("observe_step_time");
-        // std::vector<uint> dark_prior = config.get("dark_prior");
-        // uint light_prior = config.get("light_prior");
-
-        // Computed values for initializing robot positions
-        // (This goes here because num_robots is possibly changeable)
-        uint num_rows = ceil(sqrt(num_robots));
-        double x_spacing = grid_cover * world_width / num_rows;
-        double y_spacing = grid_cover * world_height / num_rows;
-
-        // Loop through the fill ratios
-        for (int f_ind = 0; f_ind < fill_ratios.size(); f_ind++)
+        // Run the trials of one condition, up to ensemble_size at a time
+        const uint condition_ind = jobs[next_job].condition_ind;
+        const Kilosim::SweepCondition &condition = plan.conditions[condition_ind];
+        if (contexts_condition_ind != (int)condition_ind)
         {
+            contexts.clear();
+            contexts_condition_ind = condition_ind;
+        }
 
-            seed_rand(seed_base); // For random number configuration
-
-            // Set fill ratio and logging file name
-            double fill_ratio = fill_ratios[f_ind];
-            std::ostringstream ss;
-            ss << std::fixed << std::setprecision(2) << fill_ratio;
-            std::string fill_ratio_str = ss.str();
-            std::ostringstream cs;
-            cs << compare_val;
-            std::string compare_val_str = cs.str();
-            //std::vector<std::string> compare_vals = config.get(compare_param);
-            //std::string compare_val = compare_vals[0];
-            std::string log_filename = log_dir + compare_param + '=' + compare_val_str + '-' + fill_ratio_str + ".h5";
-
-            // Run all trials for this parameter set
-            for (uint trial = start_trial; trial < (num_trials + start_trial); trial++)
+        // Start the condition's next trial in ensemble slot i, skipping any
+        // whose cell already has enough trials. Returns false if none are left.
+        std::vector<std::unique_ptr<TrialRun>> runs(ensemble_size);
+        auto start_next_job = [&](uint i) {
+            while (next_job < jobs.size() && jobs[next_job].condition_ind == condition_ind)
             {
-                if (show_progress)
-                {
-                    printf("\n\n");
-                    printf("-------------------------------------------------------\n");
-                    std::cout << "    TRIAL " << trial << "    [" << fill_ratio << "]    " << compare_param << " = " << compare_val << std::endl;
-                    printf("-------------------------------------------------------\n");
-                }
-                ProgressBar progress_bar(limit, 50);
-
-                // Configure light image filename
-                std::string light_img_filename = light_img_src + "rect-" + fill_ratio_str + "-" + std::to_string(trial) + ".png";
-
-                // Initialize World (and Viewer)
-                Kilosim::World world(
-                    world_width,
-                    world_height,
-                    light_img_filename);
-
-                Kilosim::Viewer viewer(world);
-
-                // Create robots and initialize in grid
-                std::vector<Kilosim::BayesBot *> robots(num_robots);
-                for (int n = 0; n < num_robots; n++)
-                {
-                    // Set any implementation-specific config that comes from config file
-                    robots[n] = new Kilosim::BayesBot();
-                    robots[n]->credible_thresh = credible_thresh;
-                    robots[n]->allow_simultaneity = allow_simultaneity;
-                    robots[n]->use_positive_feedback = use_positive_feedback;
-                    robots[n]->observe_step_time = observe_step_time;
-                    robots[n]->dark_prior = both_prior;
-                    robots[n]->light_prior = both_prior;
-                    world.add_robot(robots[n]);
-                    // robots[n]->robot_init(n * 50 + 100, 100, PI / 2);
-                    robots[n]->robot_init((n / num_rows + 0.5) * x_spacing + x_pos_offset,
-                                          (n % num_rows + 0.5) * y_spacing + y_pos_offset,
-                                          uniform_rand_real(0, 2 * PI));
-                }
-                // Verify that robots are within World bounds and not overlapping
-                world.check_validity();
-
-                // Set up logging
-                Kilosim::Logger logger(
-                    world,
-                    log_filename,
-                    trial,
-                    false);
-                logger.add_aggregator("light_count", robot_light_count);
-                logger.add_aggregator("dark_count", robot_dark_count);
-                logger.add_aggregator("decision", robot_decision);
-                logger.add_aggregator("observation_count", robot_observation_count);
-                logger.log_config(config, false);
-                // Log the fill_ratio separately because it's not in the config
-                logger.log_param("fill_ratio", fill_ratio);
-                // Add logging of compare_param
-                logger.log_param(compare_param, compare_val);
-
-                while (world.get_time() < trial_duration)
+                const Kilosim::TrialJob &job = jobs[next_job++];
+                if (stats.is_converged(job.condition_ind, job.fill_ind))
                 {
-                    // Run a simulation step
-                    // This automatically increments the tick
-                    world.step();
-
-                    viewer.draw();
-
-                    if ((world.get_tick() % (log_freq * world.get_tick_rate())) == 0)
-                    {
-                        // Log the state of the world every 5 seconds
-                        // This works because the tickRate (ticks/sec) must be an integer
-                        logger.log_state();
-
-                        // End trial early if all of the robots have decided
-                        // And only allow this after the decisions have been logged!
-                        if (all_robots_decided(robots))
-                            break;
-                    }
-                    if (show_progress && (world.get_tick() % (progress_update_freq * world.get_tick_rate())) == 0)
-                    {
-                        ++progress_bar;
-                        progress_bar.display();
-                    }
+                    telemetry.skip_trial();
+                    continue;
                 }
-
-                // Print out statistics when trial is finished.
-                if (show_progress)
+                if (i >= contexts.size())
                 {
-                    progress_bar.done();
+                    // The first trial's light image is only a placeholder;
+                    // every trial loads its own in begin_trial
+                    uint num_robots = condition.params["num_robots"];
+                    contexts.emplace_back(new Kilosim::TrialContext(
+                        world_width, world_height,
+                        settings.light_img_src + "rect-" + plan.fill_ratio_str(job.fill_ind) +
+                            "-" + std::to_string(job.trial) + ".png",
+                        placement.place(num_robots),
+                        condition_bot_params(condition),
+                        true, settings.trace_duration > 0));
                 }
-                int acc_decision = 0;
-                int undecided_count = 0;
-                for (int i = 0; i < robots.size(); i++)
+                runs[i].reset(new TrialRun(settings, *contexts[i], job, i));
+                runs[i]->start();
+                return true;
+            }
+            return false;
+        };
+        uint num_active = 0;
+        for (uint i = 0; i < ensemble_size && start_next_job(i); i++)
+            num_active++;
+
+        // Advance all trials in lockstep between log points, in order on this
+        // thread. (Not in parallel: Kilosim's random number generator is
+        // shared by every World.)
+        while (num_active > 0)
+        {
+            for (uint i = 0; i < runs.size(); i++)
+            {
+                if (!runs[i])
+                    continue;
+                runs[i]->advance();
+                runs[i]->sync();
+                if (runs[i]->is_done)
                 {
-                    if (robots[i]->decision == -1)
-                        undecided_count++;
-                    else
-                        acc_decision += robots[i]->decision;
+                    // A finished trial hands its slot to the condition's next
+                    // trial, so no slot waits for the slowest one
+                    stats.add(runs[i]->job.condition_ind, runs[i]->job.fill_ind, runs[i]->finish());
+                    runs[i].reset();
+                    if (!start_next_job(i))
+                        num_active--;
                 }
-                double decision_accuracy = (double)acc_decision / robots.size();
-                int time = world.get_time();
-                std::cout << "Simulated duration:\t"
-                          << std::setfill('0') << std::setw(2) << (int)(time / 3600) << ":"
-                          << std::setfill('0') << std::setw(2) << (int)((time % 3600) / 60) << ":"
-                          << std::setfill('0') << std::setw(2) << time % 60 << std::endl;
-                std::cout << "Decision accuracy:\t" << decision_accuracy * 100 << "%" << std::endl;
-                std::cout << "Undecided robots:\t" << undecided_count << "/" << robots.size() << std::endl;
             }
         }
     }
 
+    telemetry.stop();
     printf("\n\nSimulations complete\n\n");
 
+    // Accuracy and decision time of each condition/fill ratio (this shard)
+    std::string summary_filename = settings.log_dir + "trial_summary" +
+                                   (num_shards > 1 ? "-shard_" + std::to_string(shard_ind) : "") + ".tsv";
+    std::ofstream summary_file(summary_filename);
+    stats.write_summary(summary_file, plan);
+    stats.write_summary(std::cout, plan);
+
+    // Reduced controller rates against full rate (if both were run)
+    if (plan.is_swept("controller_period"))
+    {
+        std::string validation_filename = settings.log_dir + "rate_validation" +
+                                          (num_shards > 1 ? "-shard_" + std::to_string(shard_ind) : "") + ".tsv";
+        std::ofstream validation_file(validation_filename);
+        stats.write_comparison(validation_file, plan, "controller_period", 1);
+        printf("\n");
+        stats.write_comparison(std::cout, plan, "controller_period", 1);
+    }
+
     return 0;
 }
@@ -0,0 +1,81 @@
+/*
+ * Controller-only benchmark, replaying a recorded trace (see
+ * ControllerTrace.hpp and `trace_duration` in the README)
+ *
+ * Feeds the recorded light readings and messages straight to the controllers,
+ * with no physics, for the generic BayesBot and the specialized variant.
+ * Reports the time per loop() call and checks that the final controller
+ * states match the recording (exit code 1 if not).
+ *
+ * Usage: kilosim_demo_replay TRACE_FILE [repeats]
+ */
+
+#include "BayesBot.cpp"
+#include "ControllerTrace.hpp"
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        std::cout << "ERROR: You must provide a trace file name" << std::endl;
+        std::cout << "Usage: kilosim_demo_replay TRACE_FILE [repeats]" << std::endl;
+        exit(1);
+    }
+    std::string trace_filename = argv[1];
+    uint repeats = argc > 2 ? std::stoul(argv[2]) : 10;
+
+    Kilosim::TracePlayer player;
+    if (!player.load(trace_filename))
+    {
+        std::cout << "ERROR: " << trace_filename << " is not a valid trace" << std::endl;
+        exit(1);
+    }
+    std::cout << "Robots: " << player.num_robots() << std::endl;
+
+    std::cout << std::setw(12) << "controller"
+              << std::setw(16) << "loop calls"
+              << std::setw(16) << "ns/loop"
+              << std::setw(12) << "matches" << std::endl;
+    bool all_match = true;
+    for (int specialize = 0; specialize < 2; specialize++)
+    {
+        double elapsed = 0;
+        uint64_t num_loops = 0;
+        int mismatch = -1;
+        for (uint r = 0; r < repeats; r++)
+        {
+            // Only the replay itself is timed, not building the controllers
+            if (!player.reset(specialize))
+            {
+                std::cout << "ERROR: Trace's starting state does not load" << std::endl;
+                exit(1);
+            }
+            auto start = std::chrono::steady_clock::now();
+            num_loops = player.play();
+            auto end = std::chrono::steady_clock::now();
+            elapsed += std::chrono::duration<double>(end - start).count();
+            mismatch = num_loops > 0 ? player.first_mismatch() : 0;
+        }
+        bool matches = num_loops > 0 && mismatch < 0;
+        all_match = all_match && matches;
+        std::cout << std::setw(12) << (specialize ? "specialized" : "generic")
+                  << std::setw(16) << num_loops
+                  << std::setw(16) << std::fixed << std::setprecision(3)
+                  << (num_loops > 0 ? elapsed * 1e9 / (num_loops * repeats) : 0)
+                  << std::setw(12) << (matches ? "yes" : "NO") << std::endl;
+        if (!matches)
+        {
+            if (num_loops == 0)
+                std::cout << "Controller calls diverged from the trace" << std::endl;
+            else
+                std::cout << "Robot " << mismatch << " ended in a different state" << std::endl;
+        }
+    }
+
+    return all_match ? 0 : 1;
+}
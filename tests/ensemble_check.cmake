@@ -0,0 +1,76 @@
+# Runs the same three trials with ensemble_size 1 and 3, and checks that every
+# trial's result and log rows are identical (see "Running trials side by
+# side" in the README)
+#
+# Usage: cmake -DDEMO=<kilosim_demo> -DSOURCE_DIR=<repo> -DWORK_DIR=<dir>
+#              [-DH5DIFF=<h5diff>] -P ensemble_check.cmake
+
+file(REMOVE_RECURSE ${WORK_DIR})
+file(MAKE_DIRECTORY ${WORK_DIR})
+# Every trial uses the same light image
+foreach(trial 1 2 3)
+  configure_file(${SOURCE_DIR}/rect-0.70-1.png ${WORK_DIR}/rect-0.70-${trial}.png COPYONLY)
+endforeach()
+
+foreach(ensemble_size 1 3)
+  set(log_dir ${WORK_DIR}/ensemble_${ensemble_size}/)
+  file(MAKE_DIRECTORY ${log_dir})
+  file(WRITE ${WORK_DIR}/ensemble_${ensemble_size}.json "{
+    \"compare_param\": \"use_positive_feedback\",
+    \"world_width\": 2400,
+    \"world_height\": 2400,
+    \"num_robots\": 100,
+    \"placement\": \"random_uniform\",
+    \"light_img_src\": \"${WORK_DIR}/\",
+    \"trial_duration\": 60,
+    \"log_dir\": \"${log_dir}\",
+    \"log_filename_base\": \"test-\",
+    \"log_freq\": 5,
+    \"num_trials\": 3,
+    \"start_trial\": 1,
+    \"credible_thresh\": 0.9,
+    \"allow_simultaneity\": 1,
+    \"observe_step_time\": 45,
+    \"use_positive_feedback\": [1],
+    \"both_prior\": 10,
+    \"seed_base\": 999999999,
+    \"fill_ratios\": [0.7],
+    \"ensemble_size\": ${ensemble_size},
+    \"draw\": 0,
+    \"status_period\": 0
+}
+")
+  execute_process(COMMAND ${DEMO} ${WORK_DIR}/ensemble_${ensemble_size}.json
+                  RESULT_VARIABLE result OUTPUT_QUIET)
+  if(NOT result EQUAL 0)
+    message(FATAL_ERROR "kilosim_demo failed with ensemble_size ${ensemble_size}")
+  endif()
+  # Trials may finish in a different order
+  file(STRINGS ${log_dir}completed_trials.tsv journal_${ensemble_size})
+  list(SORT journal_${ensemble_size})
+endforeach()
+
+if(NOT journal_1 STREQUAL journal_3)
+  message(FATAL_ERROR "Trial results differ between ensemble_size 1 and 3:\n"
+                      "${journal_1}\n${journal_3}")
+endif()
+
+if(NOT H5DIFF)
+  message(STATUS "h5diff not found, so only trial results were compared")
+  return()
+endif()
+file(GLOB log_files RELATIVE ${WORK_DIR}/ensemble_1 ${WORK_DIR}/ensemble_1/*.h5)
+if(NOT log_files)
+  message(FATAL_ERROR "No log files written")
+endif()
+foreach(log_file ${log_files})
+  # Only the trials' rows (the params include ensemble_size)
+  foreach(trial 1 2 3)
+    execute_process(COMMAND ${H5DIFF} ${WORK_DIR}/ensemble_1/${log_file}
+                            ${WORK_DIR}/ensemble_3/${log_file} /trial_${trial} /trial_${trial}
+                    RESULT_VARIABLE result OUTPUT_VARIABLE diff)
+    if(NOT result EQUAL 0)
+      message(FATAL_ERROR "trial_${trial} of ${log_file} differs between ensemble_size 1 and 3:\n${diff}")
+    endif()
+  endforeach()
+endforeach()
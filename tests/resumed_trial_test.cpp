@@ -0,0 +1,112 @@
+/*
+ * Regression test for joining a resumed trial's rows (LogReader::read)
+ *
+ * Writes a log file in which trial_2 was resumed from snapshots twice, reads
+ * it back, and checks that the joined curve has every log point exactly once,
+ * including the rows logged at the times the snapshots were taken.
+ *
+ * Usage: kilosim_resumed_trial_test [work_dir]
+ */
+
+#include "SweepAnalysis.hpp"
+
+#include <math.h>
+#include <stdio.h>
+#include <iostream>
+#include <string>
+#include <vector>
+
+const int num_robots = 4;
+const double log_freq = 5;
+
+void write_group(hid_t file, const std::string &name, double first_time, double last_time,
+                 double restored_from_time)
+{
+    // One trial group with rows from first_time to last_time. Robot r decides
+    // correctly (1) at time 10 * (r + 1), so 3 of the 4 have decided at 30.
+    std::vector<double> time;
+    std::vector<double> decision;
+    for (double t = first_time; t <= last_time; t += log_freq)
+    {
+        time.push_back(t);
+        for (int r = 0; r < num_robots; r++)
+            decision.push_back(t >= 10 * (r + 1) ? 1 : -1);
+    }
+    hid_t group = H5Gcreate2(file, name.c_str(), H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+    hsize_t time_dims[1] = {time.size()};
+    hid_t space = H5Screate_simple(1, time_dims, NULL);
+    hid_t dataset = H5Dcreate2(group, "time", H5T_NATIVE_DOUBLE, space, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+    H5Dwrite(dataset, H5T_NATIVE_DOUBLE, H5S_ALL, H5S_ALL, H5P_DEFAULT, time.data());
+    H5Dclose(dataset);
+    H5Sclose(space);
+    hsize_t decision_dims[2] = {time.size(), num_robots};
+    space = H5Screate_simple(2, decision_dims, NULL);
+    dataset = H5Dcreate2(group, "decision", H5T_NATIVE_DOUBLE, space, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+    H5Dwrite(dataset, H5T_NATIVE_DOUBLE, H5S_ALL, H5S_ALL, H5P_DEFAULT, decision.data());
+    H5Dclose(dataset);
+    H5Sclose(space);
+    if (restored_from_time >= 0)
+    {
+        hid_t params = H5Gcreate2(group, "params", H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+        space = H5Screate(H5S_SCALAR);
+        dataset = H5Dcreate2(params, "restored_from_time", H5T_NATIVE_DOUBLE, space,
+                             H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+        H5Dwrite(dataset, H5T_NATIVE_DOUBLE, H5S_ALL, H5S_ALL, H5P_DEFAULT, &restored_from_time);
+        H5Dclose(dataset);
+        H5Sclose(space);
+        H5Gclose(params);
+    }
+    H5Gclose(group);
+}
+
+bool check(bool ok, const std::string &what)
+{
+    if (!ok)
+        std::cout << "FAILED: " << what << std::endl;
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    std::string work_dir = argc > 1 ? std::string(argv[1]) + "/" : "";
+    std::string filename = work_dir + "resumed-0.70.h5";
+
+    // Same layout as a sweep (32 ticks/sec): trial_2 was killed at 20 s and
+    // resumed from its snapshot at 15 s, then killed at 40 s and resumed from
+    // its snapshot at 30 s. Each run logged a row at its snapshot's time
+    // before taking the snapshot. trial_3 never finished.
+    hid_t file = H5Fcreate(filename.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+    if (file < 0)
+    {
+        std::cout << "ERROR: Unable to create " << filename << std::endl;
+        exit(1);
+    }
+    write_group(file, "trial_1", 0, 65, -1);
+    write_group(file, "trial_2_until_tick_480", 0, 20, -1);
+    write_group(file, "trial_2_until_tick_960", 20, 40, 15);
+    write_group(file, "trial_2", 35, 65, 30);
+    write_group(file, "trial_3_until_tick_480", 0, 20, -1);
+    H5Fclose(file);
+
+    Kilosim::LogFile log;
+    bool ok = check(Kilosim::parse_log_filename(filename, log), "parse_log_filename");
+    ok = ok && check(Kilosim::LogReader().read(log), "LogReader::read");
+    ok = ok && check(log.trials.size() == 2, "only complete trials are read");
+    for (size_t i = 0; ok && i < log.trials.size(); i++)
+    {
+        // Both trials have the same rows once trial_2 is joined
+        const Kilosim::TrialCurve &curve = log.trials[i];
+        std::string trial = "trial " + std::to_string(i + 1);
+        ok = check(curve.time.size() == 14, trial + " has one row per log point") && ok;
+        for (size_t row = 0; row < curve.time.size(); row++)
+            ok = check(curve.time[row] == row * log_freq, trial + " row " + std::to_string(row)) && ok;
+        ok = check(Kilosim::decided_time(curve, 0.75) == 30, trial + " reaches 75% decided at 30 s") && ok;
+        ok = check(curve.accuracy.back() == 1, trial + " ends fully accurate") && ok;
+    }
+    remove(filename.c_str());
+
+    if (!ok)
+        return 1;
+    std::cout << "Resumed trials joined correctly" << std::endl;
+    return 0;
+}